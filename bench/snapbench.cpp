@@ -0,0 +1,416 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "popl.hpp"
+#include "common/endian.h"
+#include "common/sampleFormat.h"
+#include "common/snapException.h"
+#include "common/utils.h"
+#include "message/pcmChunk.h"
+#include "encoder/encoderFactory.h"
+#include "decoder/pcmDecoder.h"
+#include "decoder/deltaDecoder.h"
+#include "decoder/flacDecoder.h"
+#if defined(HAS_OGG) || defined(HAS_TREMOR)
+#include "decoder/oggDecoder.h"
+#endif
+
+
+using namespace std;
+using namespace popl;
+
+
+/// Number of calls into the allocator
+/**
+ * On glibc the allocator functions are interposed, so that allocations
+ * done by the codec libraries are counted as well.
+ */
+static std::atomic<size_t> g_allocations(0);
+
+#ifdef __GLIBC__
+extern "C"
+{
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) __THROW
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) __THROW
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) __THROW
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+
+
+/// Per call timing and allocation statistics of one encoder or decoder run
+struct Stats
+{
+	Stats() : allocations(0), calls(0)
+	{
+	}
+
+	void add(const chronos::nsec& duration, size_t allocs)
+	{
+		latencies.push_back(duration.count() / 1000.);
+		allocations += allocs;
+		++calls;
+	}
+
+	double total() const
+	{
+		double sum(0);
+		for (auto latency: latencies)
+			sum += latency;
+		return sum;
+	}
+
+	double percentile(double p) const
+	{
+		if (latencies.empty())
+			return 0;
+		std::vector<double> sorted(latencies);
+		std::sort(sorted.begin(), sorted.end());
+		size_t idx = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+		return sorted[idx];
+	}
+
+	std::vector<double> latencies;
+	size_t allocations;
+	size_t calls;
+};
+
+
+
+/// Collects the encoded chunks
+class ChunkCollector : public EncoderListener
+{
+public:
+	virtual void onChunkEncoded(const Encoder* encoder, msg::PcmChunk* chunk, double duration)
+	{
+		bytes += chunk->payloadSize;
+		chunks.push_back(std::unique_ptr<msg::PcmChunk>(chunk));
+	}
+
+	std::vector<std::unique_ptr<msg::PcmChunk>> chunks;
+	size_t bytes = 0;
+};
+
+
+
+template<typename T>
+static void writeSample(char* buffer, size_t idx, double value)
+{
+	((T*)buffer)[idx] = endian::swap<T>((T)value);
+}
+
+
+/// Synthetic test signal
+/**
+ * music: a few modulated tones with a little noise
+ * noise: white noise at full scale
+ * silence: digital silence
+ */
+static std::vector<char> generateSignal(const std::string& signal, const SampleFormat& format, double seconds)
+{
+	size_t frames = (size_t)(seconds * format.rate);
+	std::vector<char> pcm(frames * format.frameSize);
+	double amplitude = std::pow(2., format.bits - 1) - 1.;
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> uniform(-1., 1.);
+	const double pi = 3.14159265358979323846;
+
+	for (size_t n = 0; n < frames; ++n)
+	{
+		double t = (double)n / format.rate;
+		for (size_t c = 0; c < format.channels; ++c)
+		{
+			double value(0);
+			if (signal == "music")
+			{
+				double envelope = 0.5 + 0.5 * std::sin(2. * pi * 0.5 * t + c);
+				value = 0.25 * std::sin(2. * pi * 220. * t) +
+					0.15 * envelope * std::sin(2. * pi * (440. + 3. * c) * t) +
+					0.1 * std::sin(2. * pi * 1250. * t) * std::sin(2. * pi * 3. * t) +
+					0.002 * uniform(rng);
+			}
+			else if (signal == "noise")
+				value = uniform(rng);
+			else if (signal != "silence")
+				throw SnapException("unknown signal: " + signal);
+
+			size_t idx = n * format.channels + c;
+			if (format.sampleSize == 1)
+				writeSample<int8_t>(pcm.data(), idx, value * amplitude);
+			else if (format.sampleSize == 2)
+				writeSample<int16_t>(pcm.data(), idx, value * amplitude);
+			else if (format.sampleSize == 4)
+				writeSample<int32_t>(pcm.data(), idx, value * amplitude);
+		}
+	}
+	return pcm;
+}
+
+
+/// Read raw PCM or a RIFF/WAVE file (PCM encoded) into memory
+static std::vector<char> readFile(const std::string& filename, SampleFormat& format)
+{
+	ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+	if (!ifs.good())
+		throw SnapException("failed to open file: \"" + filename + "\"");
+	std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+	if ((data.size() < 12) || (strncmp(data.data(), "RIFF", 4) != 0) || (strncmp(data.data() + 8, "WAVE", 4) != 0))
+		return data;
+
+	/// Let the PcmDecoder parse the format, search the data chunk here
+	msg::CodecHeader header("pcm");
+	header.payload = (char*)realloc(header.payload, data.size());
+	memcpy(header.payload, data.data(), data.size());
+	header.payloadSize = data.size();
+	format = PcmDecoder().setHeader(&header);
+
+	size_t pos = 12;
+	while (pos + 8 <= data.size())
+	{
+		uint32_t size;
+		memcpy(&size, data.data() + pos + 4, sizeof(size));
+		size = SWAP_32(size);
+		if (strncmp(data.data() + pos, "data", 4) == 0)
+		{
+			size = std::min((size_t)size, data.size() - pos - 8);
+			return std::vector<char>(data.begin() + pos + 8, data.begin() + pos + 8 + size);
+		}
+		pos += 8 + size;
+	}
+	throw SnapException("no data chunk found in: \"" + filename + "\"");
+}
+
+
+static Decoder* createDecoder(const std::string& codec)
+{
+	if (codec == "pcm")
+		return new PcmDecoder();
+#if defined(HAS_OGG) || defined(HAS_TREMOR)
+	else if (codec == "ogg")
+		return new OggDecoder();
+#endif
+	else if (codec == "flac")
+		return new FlacDecoder();
+	else if (codec == "delta")
+		return new DeltaDecoder();
+	throw SnapException("codec not supported: \"" + codec + "\"");
+}
+
+
+static void printHeader()
+{
+	cout << left << setw(16) << "codec" << setw(12) << "format" << right
+		<< setw(9) << "kbit/s"
+		<< setw(11) << "enc RTF" << setw(32) << "enc p50/p90/p99/max [us]" << setw(8) << "alloc"
+		<< setw(11) << "dec RTF" << setw(32) << "dec p50/p90/p99/max [us]" << setw(8) << "alloc"
+		<< setw(10) << "lossless" << "\n";
+}
+
+
+static std::string percentiles(const Stats& stats)
+{
+	stringstream ss;
+	ss << fixed << setprecision(1)
+		<< stats.percentile(0.5) << "/" << stats.percentile(0.9) << "/" << stats.percentile(0.99) << "/" << stats.percentile(1.);
+	return ss.str();
+}
+
+
+/// Encode and decode the PCM data with one codec and print a line of results
+static void benchmark(const std::string& codecSettings, const SampleFormat& format, const std::vector<char>& pcm, size_t chunkMs)
+{
+	EncoderFactory encoderFactory;
+	std::unique_ptr<Encoder> encoder(encoderFactory.createEncoder(codecSettings));
+	ChunkCollector collector;
+	encoder->init(&collector, format);
+
+	size_t chunkBytes = format.rate * chunkMs / 1000 * format.frameSize;
+	double seconds = (double)(pcm.size() / format.frameSize) / format.rate;
+	msg::PcmChunk chunk(format, chunkMs);
+
+	Stats encodeStats;
+	for (size_t pos = 0; pos + chunkBytes <= pcm.size(); pos += chunkBytes)
+	{
+		memcpy(chunk.payload, pcm.data() + pos, chunkBytes);
+		size_t allocations = g_allocations;
+		auto start = chronos::clk::now();
+		encoder->encode(&chunk);
+		auto end = chronos::clk::now();
+		encodeStats.add(std::chrono::duration_cast<chronos::nsec>(end - start), g_allocations - allocations);
+	}
+
+	std::unique_ptr<Decoder> decoder(createDecoder(encoder->getHeader()->codec));
+	SampleFormat decodedFormat = decoder->setHeader(encoder->getHeader().get());
+
+	Stats decodeStats;
+	std::vector<char> decoded;
+	for (auto& encoded: collector.chunks)
+	{
+		size_t allocations = g_allocations;
+		auto start = chronos::clk::now();
+		bool ok = decoder->decode(encoded.get());
+		auto end = chronos::clk::now();
+		decodeStats.add(std::chrono::duration_cast<chronos::nsec>(end - start), g_allocations - allocations);
+		if (ok)
+			decoded.insert(decoded.end(), encoded->payload, encoded->payload + encoded->payloadSize);
+	}
+
+	/// Encoders may hold back some frames, compare what came through
+	size_t compareBytes = std::min(decoded.size(), pcm.size());
+	bool lossless = (decodedFormat.getFormat() == format.getFormat()) && (compareBytes > 0) && (memcmp(decoded.data(), pcm.data(), compareBytes) == 0);
+	double encodeSec = encodeStats.total() / 1000000.;
+	double decodeSec = decodeStats.total() / 1000000.;
+
+	cout << left << setw(16) << codecSettings << setw(12) << format.getFormat() << right << fixed << setprecision(1)
+		<< setw(9) << (collector.bytes * 8. / seconds / 1000.)
+		<< setw(11) << (encodeSec > 0 ? seconds / encodeSec : 0.) << setw(32) << percentiles(encodeStats)
+		<< setw(8) << (encodeStats.calls > 0 ? (double)encodeStats.allocations / encodeStats.calls : 0.)
+		<< setw(11) << (decodeSec > 0 ? seconds / decodeSec : 0.) << setw(32) << percentiles(decodeStats)
+		<< setw(8) << (decodeStats.calls > 0 ? (double)decodeStats.allocations / decodeStats.calls : 0.)
+		<< setw(10) << (lossless ? "yes" : "no") << "\n";
+}
+
+
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		string signal;
+		string filename;
+		double duration;
+		size_t chunkMs;
+
+		Switch helpSwitch("h", "help", "Produce help message");
+		Value<string> codecValue("c", "codec", "Codec to benchmark, (flac|ogg|pcm|delta)[:options]\ncan be given multiple times", "");
+		Value<string> sampleFormatValue("s", "sampleformat", "Sample format to benchmark, can be given multiple times", "");
+		Value<string> signalValue("", "signal", "Synthetic signal (music|noise|silence)", "music", &signal);
+		Value<string> fileValue("f", "file", "Raw PCM or WAV file to use instead of a synthetic signal.\nThe sample format of raw files is taken from --sampleformat", "", &filename);
+		Value<double> durationValue("d", "duration", "Duration of the synthetic signal [s]", 30., &duration);
+		Value<size_t> chunkValue("", "chunk", "Size of the PCM chunks fed into the encoder [ms]", 20, &chunkMs);
+
+		OptionParser op("Allowed options");
+		op.add(helpSwitch)
+		 .add(codecValue)
+		 .add(sampleFormatValue)
+		 .add(signalValue)
+		 .add(fileValue)
+		 .add(durationValue)
+		 .add(chunkValue);
+
+		try
+		{
+			op.parse(argc, argv);
+		}
+		catch (const std::invalid_argument& e)
+		{
+			cerr << "Exception: " << e.what() << std::endl;
+			cout << "\n" << op << "\n";
+			exit(EXIT_FAILURE);
+		}
+
+		if (helpSwitch.isSet())
+		{
+			cout << op << "\n";
+			exit(EXIT_SUCCESS);
+		}
+
+		if ((chunkMs == 0) || (duration <= 0))
+			throw SnapException("chunk size and duration must be positive");
+
+		vector<string> codecs;
+		for (size_t n=0; n<codecValue.count(); ++n)
+			codecs.push_back(codecValue.getValue(n));
+		if (codecs.empty())
+		{
+			codecs = {"pcm", "delta"};
+			for (int level = 0; level <= 8; ++level)
+				codecs.push_back("flac:" + cpt::to_string(level));
+#if defined(HAS_OGG) || defined(HAS_TREMOR)
+			for (auto quality: {"0.1", "0.5", "0.9"})
+				codecs.push_back(string("ogg:VBR:") + quality);
+#endif
+		}
+
+		vector<SampleFormat> formats;
+		for (size_t n=0; n<sampleFormatValue.count(); ++n)
+			formats.push_back(SampleFormat(sampleFormatValue.getValue(n)));
+		if (formats.empty())
+			formats = {SampleFormat("44100:16:2"), SampleFormat("48000:16:2"), SampleFormat("48000:24:2")};
+
+		printHeader();
+		if (!filename.empty())
+		{
+			SampleFormat format = formats.front();
+			std::vector<char> pcm = readFile(filename, format);
+			for (const auto& codec: codecs)
+				benchmark(codec, format, pcm, chunkMs);
+		}
+		else
+		{
+			for (const auto& format: formats)
+			{
+				std::vector<char> pcm = generateSignal(signal, format, duration);
+				for (const auto& codec: codecs)
+					benchmark(codec, format, pcm, chunkMs);
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		cerr << "Exception: " << e.what() << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+
@@ -17,18 +17,20 @@
 ***/
 
 #include <iostream>
-#include <mutex>
+#include <future>
 #include "clientConnection.h"
 #include "common/strCompat.h"
 #include "common/snapException.h"
 #include "message/hello.h"
+#include "message/serverSettings.h"
 #include "common/log.h"
 
 
 using namespace std;
+using namespace std::placeholders;
 
 
-ClientConnection::ClientConnection(MessageReceiver* receiver, const std::string& host, size_t port) : socket_(nullptr), active_(false), connected_(false), messageReceiver_(receiver), reqId_(1), host_(host), port_(port), readerThread_(NULL), sumTimeout_(chronos::msec(0))
+ClientConnection::ClientConnection(ClientMessageReceiver* receiver, const std::string& host, size_t port) : socket_(nullptr), active_(false), connected_(false), protocolVersion_(2), messageReceiver_(receiver), reqId_(1), host_(host), port_(port), sumTimeout_(chronos::msec(0))
 {
 }
 
@@ -39,21 +41,6 @@ ClientConnection::~ClientConnection()
 }
 
 
-
-void ClientConnection::socketRead(void* _to, size_t _bytes)
-{
-	size_t toRead = _bytes;
-	size_t len = 0;
-	do
-	{
-		len += socket_->read_some(asio::buffer((char*)_to + len, toRead));
-//cout << "len: " << len << ", error: " << error << endl;
-		toRead = _bytes - len;
-	}
-	while (toRead > 0);
-}
-
-
 std::string ClientConnection::getMacAddress() const
 {
 	if (socket_ == nullptr)
@@ -67,24 +54,36 @@ std::string ClientConnection::getMacAddress() const
 }
 
 
+void ClientConnection::setProtocolVersion(uint16_t version)
+{
+	protocolVersion_ = version;
+}
+
+
+uint16_t ClientConnection::getProtocolVersion() const
+{
+	return protocolVersion_;
+}
+
+
 void ClientConnection::start()
 {
 	tcp::resolver resolver(io_service_);
 	tcp::resolver::query query(tcp::v4(), host_, cpt::to_string(port_), asio::ip::resolver_query_base::numeric_service);
 	auto iterator = resolver.resolve(query);
 	logO << "Connecting\n";
+	protocolVersion_ = 2;
+	/// drop handlers left over from the last connection
+	io_service_.reset();
+	io_service_.poll();
+	io_service_.reset();
 	socket_.reset(new tcp::socket(io_service_));
-//	struct timeval tv;
-//	tv.tv_sec  = 5;
-//	tv.tv_usec = 0;
-//	cout << "socket: " << socket->native_handle() << "\n";
-//	setsockopt(socket->native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-//	setsockopt(socket->native_handle(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 	socket_->connect(*iterator);
 	connected_ = true;
 	logS(kLogNotice) << "Connected to " << socket_->remote_endpoint().address().to_string() << endl;
 	active_ = true;
-	readerThread_ = new thread(&ClientConnection::reader, this);
+	readHeader();
+	ioThread_ = thread([this]{ io_service_.run(); });
 }
 
 
@@ -92,144 +91,261 @@ void ClientConnection::stop()
 {
 	connected_ = false;
 	active_ = false;
-	try
+	io_service_.stop();
+	if (ioThread_.joinable())
 	{
-		std::error_code ec;
-		if (socket_)
-		{
-			socket_->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-			if (ec) logE << "Error in socket shutdown: " << ec.message() << endl;
-			socket_->close(ec);
-			if (ec) logE << "Error in socket close: " << ec.message() << endl;
-		}
-		if (readerThread_)
-		{
-			logD << "joining readerThread\n";
-			readerThread_->join();
-			delete readerThread_;
-		}
+		logD << "joining ioThread\n";
+		ioThread_.join();
 	}
-	catch(...)
+	/// the io_service thread is gone, the state can be cleaned up here
+	if (socket_ && socket_->is_open())
 	{
+		std::error_code ec;
+		socket_->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+		if (ec) logE << "Error in socket shutdown: " << ec.message() << endl;
+		socket_->close(ec);
+		if (ec) logE << "Error in socket close: " << ec.message() << endl;
 	}
-	readerThread_ = NULL;
+	failPendingRequests();
+	/// an aborted write still references the front of the queue until its handler ran
+	io_service_.reset();
+	io_service_.poll();
+	writeQueue_.clear();
 	socket_.reset();
-	logD << "readerThread terminated\n";
+	logD << "ioThread terminated\n";
 }
 
 
-bool ClientConnection::send(const msg::BaseMessage* message) const
+std::shared_ptr<asio::streambuf> ClientConnection::serialize(const msg::BaseMessage* message) const
+{
+	std::shared_ptr<asio::streambuf> streambuf = make_shared<asio::streambuf>();
+	std::ostream stream(streambuf.get());
+	tv t;
+	message->sent = t;
+	message->serialize(stream, protocolVersion_);
+	return streambuf;
+}
+
+
+bool ClientConnection::send(const msg::BaseMessage* message)
 {
-//	std::unique_lock<std::mutex> mlock(mutex_);
-//logD << "send: " << message->type << ", size: " << message->getSize() << "\n";
-	std::lock_guard<std::mutex> socketLock(socketMutex_);
 	if (!connected())
 		return false;
 //logD << "send: " << message->type << ", size: " << message->getSize() << "\n";
-	asio::streambuf streambuf;
-	std::ostream stream(&streambuf);
-	tv t;
-	message->sent = t;
-	message->serialize(stream);
-	asio::write(*socket_.get(), streambuf);
+	io_service_.post(bind(&ClientConnection::queueWrite, this, serialize(message)));
+	return true;
+}
+
+
+bool ClientConnection::sendRequest(const msg::BaseMessage* message, const chronos::msec& timeout, const ResponseHandler& handler)
+{
+	if (!connected())
+		return false;
+	uint16_t id = reqId_++;
+	if (id >= 10000)
+	{
+		reqId_ = 2;
+		id = 1;
+	}
+	message->id = id;
+	io_service_.post(bind(&ClientConnection::queueRequest, this, id, timeout, handler, serialize(message)));
 	return true;
 }
 
 
 shared_ptr<msg::SerializedMessage> ClientConnection::sendRequest(const msg::BaseMessage* message, const chronos::msec& timeout)
 {
-	shared_ptr<msg::SerializedMessage> response(NULL);
-	if (++reqId_ >= 10000)
-		reqId_ = 1;
-	message->id = reqId_;
-//	logO << "Req: " << message->id << "\n";
-	shared_ptr<PendingRequest> pendingRequest(new PendingRequest(reqId_));
-
-	std::unique_lock<std::mutex> lock(pendingRequestsMutex_);
-	pendingRequests_.insert(pendingRequest);
-	send(message);
-	if (pendingRequest->cv.wait_for(lock, std::chrono::milliseconds(timeout)) == std::cv_status::no_timeout)
+	auto promise = make_shared<std::promise<shared_ptr<msg::SerializedMessage>>>();
+	std::future<shared_ptr<msg::SerializedMessage>> future = promise->get_future();
+	if (!sendRequest(message, timeout, [promise](const shared_ptr<msg::SerializedMessage>& response){ promise->set_value(response); }))
+		return nullptr;
+
+	/// the handler is called on timeout, waiting longer covers a stopped io_service
+	shared_ptr<msg::SerializedMessage> response(nullptr);
+	if (future.wait_for(timeout + chronos::msec(100)) == std::future_status::ready)
+		response = future.get();
+
+	if (response)
 	{
-		response = pendingRequest->response;
 		sumTimeout_ = chronos::msec(0);
-//		logO << "Resp: " << pendingRequest->id << "\n";
 	}
 	else
 	{
 		sumTimeout_ += timeout;
-		logO << "timeout while waiting for response to: " << reqId_ << ", timeout " << sumTimeout_.count() << "\n";
+		logO << "timeout while waiting for response to: " << message->id << ", timeout " << sumTimeout_.count() << "\n";
 		if (sumTimeout_ > chronos::sec(10))
 			throw SnapException("sum timeout exceeded 10s");
 	}
-	pendingRequests_.erase(pendingRequest);
 	return response;
 }
 
 
-void ClientConnection::getNextMessage()
+void ClientConnection::queueRequest(uint16_t id, const chronos::msec& timeout, const ResponseHandler& handler, const std::shared_ptr<asio::streambuf>& streambuf)
 {
-	msg::BaseMessage baseMessage;
-	size_t baseMsgSize = baseMessage.getSize();
-	vector<char> buffer(baseMsgSize);
-	socketRead(&buffer[0], baseMsgSize);
-	baseMessage.deserialize(&buffer[0]);
-//	logD << "getNextMessage: " << baseMessage.type << ", size: " << baseMessage.size << ", id: " << baseMessage.id << ", refers: " << baseMessage.refersTo << "\n";
-	if (baseMessage.size > buffer.size())
-		buffer.resize(baseMessage.size);
-//	{
-//		std::lock_guard<std::mutex> socketLock(socketMutex_);
-	socketRead(&buffer[0], baseMessage.size);
-//	}
-	tv t;
-	baseMessage.received = t;
+	if (!active_)
+	{
+		handler(nullptr);
+		return;
+	}
+	shared_ptr<PendingRequest> request = make_shared<PendingRequest>(id, handler);
+	request->timer.reset(new asio::steady_timer(io_service_, timeout));
+	request->timer->async_wait(bind(&ClientConnection::handleRequestTimeout, this, id, _1));
+	pendingRequests_[id] = request;
+	queueWrite(streambuf);
+}
+
+
+void ClientConnection::handleRequestTimeout(uint16_t id, const std::error_code& ec)
+{
+	/// cancelled: the response arrived
+	if (ec)
+		return;
+	auto iter = pendingRequests_.find(id);
+	if (iter == pendingRequests_.end())
+		return;
+	ResponseHandler handler = iter->second->handler;
+	pendingRequests_.erase(iter);
+	handler(nullptr);
+}
 
+
+void ClientConnection::failPendingRequests()
+{
+	auto pendingRequests = std::move(pendingRequests_);
+	pendingRequests_.clear();
+	for (auto& request: pendingRequests)
+		request.second->handler(nullptr);
+}
+
+
+void ClientConnection::queueWrite(const std::shared_ptr<asio::streambuf>& streambuf)
+{
+	if (!active_)
+		return;
+	writeQueue_.push_back(streambuf);
+	if (writeQueue_.size() == 1)
+		asio::async_write(*socket_, *writeQueue_.front(), bind(&ClientConnection::handleWrite, this, _1, _2));
+}
+
+
+void ClientConnection::handleWrite(const std::error_code& ec, std::size_t length)
+{
+	/// no write in flight: the queue can be dropped
+	if (ec)
 	{
-		std::unique_lock<std::mutex> lock(pendingRequestsMutex_);
-//		logD << "got lock - getNextMessage: " << baseMessage.type << ", size: " << baseMessage.size << ", id: " << baseMessage.id << ", refers: " << baseMessage.refersTo << "\n";
-		{
-			for (auto req: pendingRequests_)
-			{
-				if (req->id == baseMessage.refersTo)
-				{
-					req->response.reset(new msg::SerializedMessage());
-					req->response->message = baseMessage;
-					req->response->buffer = (char*)malloc(baseMessage.size);
-					memcpy(req->response->buffer, &buffer[0], baseMessage.size);
-					lock.unlock();
-					req->cv.notify_one();
-					return;
-				}
-			}
-		}
+		writeQueue_.clear();
+		onError("Error while writing: " + ec.message());
+		return;
 	}
+	writeQueue_.pop_front();
+	if (!active_)
+	{
+		writeQueue_.clear();
+		return;
+	}
+	if (!writeQueue_.empty())
+		asio::async_write(*socket_, *writeQueue_.front(), bind(&ClientConnection::handleWrite, this, _1, _2));
+}
 
-	if (messageReceiver_ != NULL)
-		messageReceiver_->onMessageReceived(this, baseMessage, &buffer[0]);
+
+void ClientConnection::readHeader()
+{
+	buffer_.resize(baseMessage_.getSize());
+	asio::async_read(*socket_, asio::buffer(&buffer_[0], baseMessage_.getSize()), bind(&ClientConnection::handleReadHeader, this, _1, _2));
 }
 
 
+void ClientConnection::handleReadHeader(const std::error_code& ec, std::size_t length)
+{
+	if (ec)
+	{
+		onError("Error while reading: " + ec.message());
+		return;
+	}
+	baseMessage_.deserialize(&buffer_[0], protocolVersion_);
+//	logD << "getNextMessage: " << baseMessage_.type << ", size: " << baseMessage_.size << ", id: " << baseMessage_.id << ", refers: " << baseMessage_.refersTo << "\n";
+	if (baseMessage_.size > msg::max_size)
+	{
+		onError("message too large: " + cpt::to_string(baseMessage_.size));
+		return;
+	}
+	/// one byte more than the payload: &buffer_[0] is valid for empty messages
+	buffer_.resize(baseMessage_.size + 1);
+	asio::async_read(*socket_, asio::buffer(&buffer_[0], baseMessage_.size), bind(&ClientConnection::handleReadPayload, this, _1, _2));
+}
+
 
-void ClientConnection::reader()
+void ClientConnection::handleReadPayload(const std::error_code& ec, std::size_t length)
 {
+	if (ec)
+	{
+		onError("Error while reading: " + ec.message());
+		return;
+	}
+	tv t;
+	baseMessage_.received = t;
 	try
 	{
-		while(active_)
-		{
-			getNextMessage();
-		}
+		dispatch();
 	}
 	catch (const std::exception& e)
 	{
-		if (messageReceiver_ != NULL)
-			messageReceiver_->onException(this, e);
+		onError(e.what());
+		return;
 	}
-	catch (...)
+	if (active_)
+		readHeader();
+}
+
+
+void ClientConnection::dispatch()
+{
+	if (baseMessage_.refersTo != 0)
 	{
+		auto iter = pendingRequests_.find(baseMessage_.refersTo);
+		if (iter != pendingRequests_.end())
+		{
+			shared_ptr<msg::SerializedMessage> response(new msg::SerializedMessage());
+			response->message = baseMessage_;
+			response->buffer = (char*)malloc(baseMessage_.size);
+			memcpy(response->buffer, &buffer_[0], baseMessage_.size);
+			ResponseHandler handler = iter->second->handler;
+			/// destroys the timer, i.e. cancels the timeout
+			pendingRequests_.erase(iter);
+			handler(response);
+			return;
+		}
 	}
-	connected_ = false;
-	active_ = false;
+
+	/// The protocol version changes right after the ServerSettings, i.e. before the next message is read
+	if (baseMessage_.type == message_type::kServerSettings)
+	{
+		msg::ServerSettings serverSettings;
+		serverSettings.deserialize(baseMessage_, &buffer_[0]);
+		if (serverSettings.getProtocolVersion() != protocolVersion_)
+		{
+			logO << "Protocol version: " << serverSettings.getProtocolVersion() << "\n";
+			protocolVersion_ = serverSettings.getProtocolVersion();
+		}
+	}
+
+	if (messageReceiver_ != NULL)
+		messageReceiver_->onMessageReceived(this, baseMessage_, &buffer_[0]);
 }
 
 
+void ClientConnection::onError(const std::string& error)
+{
+	if (!active_)
+		return;
+	connected_ = false;
+	active_ = false;
+	failPendingRequests();
+	/// aborts an outstanding write, its handler drops the queue
+	std::error_code ec;
+	socket_->close(ec);
+	if (messageReceiver_ != NULL)
+		messageReceiver_->onException(this, SnapException(error));
+}
 
 
@@ -22,11 +22,11 @@
 #include <string>
 #include <thread>
 #include <atomic>
-#include <mutex>
 #include <memory>
 #include <asio.hpp>
-#include <condition_variable>
-#include <set>
+#include <deque>
+#include <map>
+#include <functional>
 #include "message/message.h"
 #include "common/timeDefs.h"
 
@@ -37,19 +37,23 @@ using asio::ip::tcp;
 class ClientConnection;
 
 
-/// Used to synchronize server requests (wait for server response)
+/// Called with the response to a request, or with nullptr on timeout or disconnect
+typedef std::function<void(const std::shared_ptr<msg::SerializedMessage>& response)> ResponseHandler;
+
+
+/// Request waiting for the server's response
 struct PendingRequest
 {
-	PendingRequest(uint16_t reqId) : id(reqId), response(NULL) {};
+	PendingRequest(uint16_t reqId, const ResponseHandler& responseHandler) : id(reqId), handler(responseHandler) {};
 
 	uint16_t id;
-	std::shared_ptr<msg::SerializedMessage> response;
-	std::condition_variable cv;
+	ResponseHandler handler;
+	std::unique_ptr<asio::steady_timer> timer;
 };
 
 
 /// Interface: callback for a received message and error reporting
-class MessageReceiver
+class ClientMessageReceiver
 {
 public:
 	virtual void onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer) = 0;
@@ -59,21 +63,27 @@ public:
 
 /// Endpoint of the server connection
 /**
- * Server connection endpoint.
- * Messages are sent to the server with the "send" method (async).
- * Messages are sent sync to server with the sendReq method.
+ * Server connection endpoint, all socket I/O is async on one io_service thread.
+ * Messages are sent to the server with the "send" method: they are serialized by the caller
+ * and appended to a write queue, i.e. send never blocks on the socket.
+ * Requests (sendRequest) are matched to their responses by id, the response is passed
+ * to a callback or returned to the waiting caller.
+ * Received messages and errors are passed to the ClientMessageReceiver on the io_service thread
  */
 class ClientConnection
 {
 public:
-	/// ctor. Received message from the server are passed to MessageReceiver
-	ClientConnection(MessageReceiver* receiver, const std::string& host, size_t port);
+	/// ctor. Received message from the server are passed to ClientMessageReceiver
+	ClientConnection(ClientMessageReceiver* receiver, const std::string& host, size_t port);
 	virtual ~ClientConnection();
 	virtual void start();
 	virtual void stop();
-	virtual bool send(const msg::BaseMessage* message) const;
+	virtual bool send(const msg::BaseMessage* message);
+
+	/// Sends a request, the handler is called on the io_service thread with the response or nullptr after "timeout"
+	virtual bool sendRequest(const msg::BaseMessage* message, const chronos::msec& timeout, const ResponseHandler& handler);
 
-	/// Send request to the server and wait for answer
+	/// Send request to the server and wait for answer. Must not be called from the ClientMessageReceiver callbacks
 	virtual std::shared_ptr<msg::SerializedMessage> sendRequest(const msg::BaseMessage* message, const chronos::msec& timeout = chronos::msec(1000));
 
 	/// Send request to the server and wait for answer of type T
@@ -90,6 +100,10 @@ public:
 
 	std::string getMacAddress() const;
 
+	/// Protocol version for sent and received messages, 2 until the server confirmed another one
+	void setProtocolVersion(uint16_t version);
+	uint16_t getProtocolVersion() const;
+
 	virtual bool active() const
 	{
 		return active_;
@@ -97,28 +111,41 @@ public:
 
 	virtual bool connected() const
 	{
-		return (socket_ != nullptr);
-//		return (connected_ && socket);
+		return connected_;
 	}
 
 protected:
-	virtual void reader();
-
-	void socketRead(void* to, size_t bytes);
-	void getNextMessage();
+	std::shared_ptr<asio::streambuf> serialize(const msg::BaseMessage* message) const;
+
+	/// Handlers, running on the io_service thread
+	void readHeader();
+	void handleReadHeader(const std::error_code& ec, std::size_t length);
+	void handleReadPayload(const std::error_code& ec, std::size_t length);
+	void dispatch();
+	void queueWrite(const std::shared_ptr<asio::streambuf>& streambuf);
+	void queueRequest(uint16_t id, const chronos::msec& timeout, const ResponseHandler& handler, const std::shared_ptr<asio::streambuf>& streambuf);
+	void handleWrite(const std::error_code& ec, std::size_t length);
+	void handleRequestTimeout(uint16_t id, const std::error_code& ec);
+	void onError(const std::string& error);
+	/// Calls the handlers of all pending requests with nullptr
+	void failPendingRequests();
 
 	asio::io_service io_service_;
-	mutable std::mutex socketMutex_;
+	std::thread ioThread_;
 	std::shared_ptr<tcp::socket> socket_;
 	std::atomic<bool> active_;
 	std::atomic<bool> connected_;
-	MessageReceiver* messageReceiver_;
-	mutable std::mutex pendingRequestsMutex_;
-	std::set<std::shared_ptr<PendingRequest>> pendingRequests_;
-	uint16_t reqId_;
+	std::atomic<uint16_t> protocolVersion_;
+	ClientMessageReceiver* messageReceiver_;
+	/// the message being read and its payload
+	msg::BaseMessage baseMessage_;
+	std::vector<char> buffer_;
+	/// serialized messages to be written, the front one is being written
+	std::deque<std::shared_ptr<asio::streambuf>> writeQueue_;
+	std::map<uint16_t, std::shared_ptr<PendingRequest>> pendingRequests_;
+	std::atomic<uint16_t> reqId_;
 	std::string host_;
 	size_t port_;
-	std::thread* readerThread_;
 	chronos::msec sumTimeout_;
 };
 
@@ -128,4 +155,3 @@ protected:
 
 
 
-
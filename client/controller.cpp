@@ -19,22 +19,37 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <cstring>
 #include "controller.h"
 #if defined(HAS_OGG) || defined(HAS_TREMOR)
 #include "decoder/oggDecoder.h"
 #endif
 #include "decoder/pcmDecoder.h"
+#include "decoder/deltaDecoder.h"
 #include "decoder/flacDecoder.h"
 #include "timeProvider.h"
 #include "message/time.h"
 #include "message/hello.h"
+#include "message/jitterReport.h"
+#include "message/chunkRequest.h"
+#include "message/wireChunkBatch.h"
+#include "message/clientStats.h"
 #include "common/snapException.h"
+#include "common/strCompat.h"
+#include "common/utils.h"
 #include "common/log.h"
 
 using namespace std;
 
+static const size_t timeSyncBurst = 20;
+static const size_t timeSyncMinReplies = 8;
+/// time to decode a chunk and pass it to the stream
+static const int32_t decodeLeadMs = 10;
+/// time for the server to resend a chunk, on top of the round trip time
+static const int32_t repairLeadMs = 30;
 
-Controller::Controller() : MessageReceiver(), active_(false), latency_(0), stream_(nullptr), decoder_(nullptr), player_(nullptr), serverSettings_(nullptr), asyncException_(false)
+
+Controller::Controller() : ClientMessageReceiver(), active_(false), latency_(0), stream_(nullptr), decoder_(nullptr), player_(nullptr), serverSettings_(nullptr), messages_(512), decodeWaiting_(false), datagramReceiver_(nullptr), udpReceiver_(nullptr), datagramPending_(false), arrivalAge_(500), lateChunks_(0), lastJitterReport_(0), decodeUsSum_(0), maxDecodeUs_(0), decodedChunks_(0), lastXruns_(0), lastResyncs_(0), serverSettingsReceived_(false), timeSyncPort_(0), timeSyncClient_(nullptr), asyncException_(false)
 {
 }
 
@@ -48,41 +63,230 @@ void Controller::onException(ClientConnection* connection, const std::exception&
 
 
 void Controller::onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer)
+{
+	/// Time sync replies are handled right away on the connection's io thread,
+	/// so that decoding does not delay them and skew the measurement
+	if (baseMessage.type == message_type::kTime)
+	{
+		msg::Time reply;
+		reply.deserialize(baseMessage, buffer);
+		TimeProvider::getInstance().setDiff(reply.latency, reply.received - reply.sent);// ToServer(diff / 2);
+		return;
+	}
+
+	/// The connection already switched to the confirmed protocol version
+	if (baseMessage.type == message_type::kServerSettings)
+	{
+		msg::ServerSettings serverSettings;
+		serverSettings.deserialize(baseMessage, buffer);
+		timeSyncPort_ = serverSettings.getTimeSyncPort();
+		serverSettingsReceived_ = true;
+	}
+
+	/// Everything else is passed in order to the decode thread
+	std::unique_ptr<msg::SerializedMessage> message(new msg::SerializedMessage());
+	message->message = baseMessage;
+	message->buffer = (char*)malloc(baseMessage.size);
+	memcpy(message->buffer, buffer, baseMessage.size);
+	while (!messages_.try_push(std::move(message)))
+	{
+		/// Never drop codec headers or settings, audio can be dropped
+		if ((baseMessage.type == message_type::kWireChunk) || (baseMessage.type == message_type::kWireChunkBatch) || !active_)
+		{
+			logE << "Decode queue full, dropping message of type " << baseMessage.type << "\n";
+			return;
+		}
+		chronos::sleep(1);
+	}
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (decodeWaiting_)
+	{
+		std::lock_guard<std::mutex> lock(decodeMutex_);
+		decodeCv_.notify_one();
+	}
+
+	/// once the clock skew is known, the offset can be extrapolated and sparse time sync is sufficient
+	if (sendTimeSyncMessage(TimeProvider::getInstance().hasSkew() ? 5000 : 1000))
+		logD << "time sync onMessageReceived\n";
+}
+
+
+void Controller::onDatagramData()
+{
+	datagramPending_ = true;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (decodeWaiting_)
+	{
+		std::lock_guard<std::mutex> lock(decodeMutex_);
+		decodeCv_.notify_one();
+	}
+}
+
+
+void Controller::decoder()
+{
+	std::unique_ptr<msg::SerializedMessage> message;
+	while (active_)
+	{
+		if (!messages_.try_pop(message))
+		{
+			datagramPending_ = false;
+			try
+			{
+				if (processDatagrams())
+					continue;
+			}
+			catch (const std::exception& e)
+			{
+				onException(clientConnection_.get(), e);
+			}
+
+			std::unique_lock<std::mutex> lock(decodeMutex_);
+			decodeWaiting_ = true;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			decodeCv_.wait_for(lock, chronos::msec(100), [this] { return (!messages_.empty() || datagramPending_ || !active_); });
+			decodeWaiting_ = false;
+			continue;
+		}
+
+		try
+		{
+			std::lock_guard<std::mutex> lock(receiveMutex_);
+			/// with multicast, chunks on the server connection are resent ones
+			if (datagramReceiver_ && datagramReceiver_->isMulticast() && (message->message.type == message_type::kWireChunk))
+			{
+				datagramReceiver_->addRepair(message->message, message->buffer);
+				datagramPending_ = true;
+			}
+			else
+				processMessage(message->message, message->buffer);
+		}
+		catch (const std::exception& e)
+		{
+			onException(clientConnection_.get(), e);
+		}
+		message.reset();
+	}
+	logD << "Decode thread stopped\n";
+}
+
+
+bool Controller::processDatagrams()
 {
 	std::lock_guard<std::mutex> lock(receiveMutex_);
+	if (!datagramReceiver_)
+		return false;
+
+	tv due = getDue();
+	chronos::usec repairLead = chronos::msec(repairLeadMs) + chronos::usec((chronos::usec::rep)TimeProvider::getInstance().getMedianRtt());
+	std::vector<uint32_t> missing = datagramReceiver_->getMissing(due, tv(std::chrono::duration_cast<chronos::nsec>(repairLead).count()));
+	if (!missing.empty())
+	{
+		logD << "Requesting " << missing.size() << " lost chunks, first: " << missing.front() << "\n";
+		msg::ChunkRequest request;
+		request.setChunks(missing);
+		clientConnection_->send(&request);
+	}
+
+	datagram::Message message;
+	if (!datagramReceiver_->getNextMessage(message, due))
+		return false;
+
+	msg::BaseMessage baseMessage;
+	if (message.data.size() < baseMessage.getSize())
+		return true;
+	baseMessage.deserialize(message.data.data(), msg::protocolVersion);
+	baseMessage.received = message.received;
+	if (baseMessage.getSize() + baseMessage.size > message.data.size())
+		return true;
+	processMessage(baseMessage, message.data.data() + baseMessage.getSize());
+	return true;
+}
+
+
+tv Controller::getDue() const
+{
+	chronos::usec lead = chronos::msec(decodeLeadMs);
+	if (stream_)
+		lead += stream_->getOutputDelay();
+	chronos::usec bufferLen = chronos::msec(serverSettings_->getBufferMs() - serverSettings_->getLatency());
+	return tv(TimeProvider::serverNow() - bufferLen + lead);
+}
+
+
+void Controller::updateTransport(msg::ServerSettings& serverSettings)
+{
+	std::string endpoint = serverSettings.getMulticast();
+	if (!endpoint.empty())
+	{
+		if (datagramReceiver_ && (datagramReceiver_->getEndpoint() == endpoint))
+			return;
+		datagramReceiver_.reset(new DatagramReceiver(this, endpoint));
+		datagramReceiver_->start();
+	}
+	else if (serverSettings.isUdp())
+	{
+		if (udpReceiver_)
+			datagramReceiver_ = std::move(udpReceiver_);
+	}
+	else
+		datagramReceiver_.reset();
+}
+
+
+void Controller::addChunk(const msg::BaseMessage& baseMessage, msg::PcmChunk* pcmChunk)
+{
+	updateJitter(baseMessage, *pcmChunk);
+//	logD << "chunk: " << pcmChunk->payloadSize << ", sampleFormat: " << sampleFormat_.rate << "\n";
+	chronos::time_point_clk decodeStart = chronos::clk::now();
+	bool decoded = decoder_->decode(pcmChunk);
+	uint64_t decodeUs = std::chrono::duration_cast<chronos::usec>(chronos::clk::now() - decodeStart).count();
+	decodeUsSum_ += decodeUs;
+	maxDecodeUs_ = std::max(maxDecodeUs_, decodeUs);
+	++decodedChunks_;
+	if (decoded)
+	{
+		stream_->addChunk(pcmChunk);
+		//logD << ", decoded: " << pcmChunk->payloadSize << ", Duration: " << pcmChunk->getDuration() << ", ns: " << pcmChunk->timestamp.nsec << ", type: " << pcmChunk->type << "\n";
+	}
+	else
+		delete pcmChunk;
+}
+
+
+void Controller::processMessage(const msg::BaseMessage& baseMessage, char* buffer)
+{
 	if (baseMessage.type == message_type::kWireChunk)
 	{
 		if (stream_ && decoder_)
 		{
 			msg::PcmChunk* pcmChunk = new msg::PcmChunk(sampleFormat_, 0);
 			pcmChunk->deserialize(baseMessage, buffer);
-//			logD << "chunk: " << pcmChunk->payloadSize << ", sampleFormat: " << sampleFormat_.rate << "\n";
-			if (decoder_->decode(pcmChunk))
-			{
-//TODO: do decoding in thread?
-				stream_->addChunk(pcmChunk);
-				//logD << ", decoded: " << pcmChunk->payloadSize << ", Duration: " << pcmChunk->getDuration() << ", sec: " << pcmChunk->timestamp.sec << ", usec: " << pcmChunk->timestamp.usec/1000 << ", type: " << pcmChunk->type << "\n";
-			}
-			else
-				delete pcmChunk;
+			addChunk(baseMessage, pcmChunk);
 		}
 	}
-	else if (baseMessage.type == message_type::kTime)
+	else if (baseMessage.type == message_type::kWireChunkBatch)
 	{
-		msg::Time reply;
-		reply.deserialize(baseMessage, buffer);
-		TimeProvider::getInstance().setDiff(reply.latency, reply.received - reply.sent);// ToServer(diff / 2);
+		if (stream_ && decoder_)
+		{
+			msg::WireChunkBatch batch;
+			batch.deserialize(baseMessage, buffer);
+			for (const auto& wireChunk: batch.chunks)
+				addChunk(baseMessage, new msg::PcmChunk(sampleFormat_, *wireChunk));
+		}
 	}
 	else if (baseMessage.type == message_type::kServerSettings)
 	{
 		serverSettings_.reset(new msg::ServerSettings());
 		serverSettings_->deserialize(baseMessage, buffer);
-		logO << "ServerSettings - buffer: " << serverSettings_->getBufferMs() << ", latency: " << serverSettings_->getLatency() << ", volume: " << serverSettings_->getVolume() << ", muted: " << serverSettings_->isMuted() << "\n";
+		logO << "ServerSettings - buffer: " << serverSettings_->getBufferMs() << ", latency: " << serverSettings_->getLatency() << ", volume: " << serverSettings_->getVolume() << ", muted: " << serverSettings_->isMuted() << ", multicast: " << serverSettings_->getMulticast() << ", udp: " << serverSettings_->isUdp() << "\n";
+		updateTransport(*serverSettings_);
 		if (stream_ && player_)
 		{
 			player_->setVolume(serverSettings_->getVolume() / 100.);
 			player_->setMute(serverSettings_->isMuted());
-			stream_->setBufferLen(serverSettings_->getBufferMs() - serverSettings_->getLatency());
+			stream_->setBufferLen(serverSettings_->getBufferMs() - serverSettings_->getLatency(), serverSettings_->isAdaptive());
 		}
 	}
 	else if (baseMessage.type == message_type::kCodecHeader)
@@ -103,6 +307,8 @@ void Controller::onMessageReceived(ClientConnection* connection, const msg::Base
 #endif
 		else if (headerChunk_->codec == "flac")
 			decoder_.reset(new FlacDecoder());
+		else if (headerChunk_->codec == "delta")
+			decoder_.reset(new DeltaDecoder());
 		else
 			throw SnapException("codec not supported: \"" + headerChunk_->codec + "\"");
 
@@ -112,23 +318,74 @@ void Controller::onMessageReceived(ClientConnection* connection, const msg::Base
 		stream_ = make_shared<Stream>(sampleFormat_);
 		stream_->setBufferLen(serverSettings_->getBufferMs() - latency_);
 
+		if (!playerSettings_.player.empty())
+			player_.reset(new FilePlayer(pcmDevice_, stream_, playerSettings_));
+		else
+		{
 #ifdef HAS_ALSA
-		player_.reset(new AlsaPlayer(pcmDevice_, stream_));
+			player_.reset(new AlsaPlayer(pcmDevice_, stream_, playerSettings_));
 #elif HAS_OPENSL
-		player_.reset(new OpenslPlayer(pcmDevice_, stream_));
+			player_.reset(new OpenslPlayer(pcmDevice_, stream_));
 #elif HAS_COREAUDIO
-		player_.reset(new CoreAudioPlayer(pcmDevice_, stream_));
+			player_.reset(new CoreAudioPlayer(pcmDevice_, stream_));
 #else
-		throw SnapException("No audio player support");
+			throw SnapException("No audio player support, use a headless player (--player)");
 #endif
+		}
 		player_->setVolume(serverSettings_->getVolume() / 100.);
 		player_->setMute(serverSettings_->isMuted());
 		player_->start();
 	}
+}
+
+
+void Controller::updateJitter(const msg::BaseMessage& baseMessage, const msg::PcmChunk& chunk)
+{
+	/// arrival age: server time of arrival - chunk timestamp
+	chronos::usec age = std::chrono::duration_cast<chronos::usec>(TimeProvider::toTimePoint(baseMessage.received) + TimeProvider::getInstance().getDiffToServer<chronos::usec>() - chunk.start());
+	arrivalAge_.add(age.count());
+	chronos::usec outputDelay = stream_->getOutputDelay();
+	if (age > chronos::msec(serverSettings_->getBufferMs() - serverSettings_->getLatency()) - outputDelay)
+		++lateChunks_;
 
-	if (baseMessage.type != message_type::kTime)
-		if (sendTimeSyncMessage(1000))
-			logD << "time sync onMessageReceived\n";
+	long now = chronos::getTickCount();
+	if ((now - lastJitterReport_ < 5000) || (arrivalAge_.size() < 50))
+		return;
+	lastJitterReport_ = now;
+
+	msg::JitterReport report;
+	report.setArrivalAge(arrivalAge_.median() / 1000, arrivalAge_.percentile(99) / 1000, arrivalAge_.percentile(100) / 1000);
+	report.setLateChunks(lateChunks_);
+	report.setRequiredBufferMs(arrivalAge_.percentile(100) / 1000 + std::chrono::duration_cast<chronos::msec>(outputDelay).count() + serverSettings_->getLatency() + 20);
+	logD << "Arrival age median: " << report.getMedianAgeMs() << ", p99: " << report.getP99AgeMs() << ", max: " << report.getMaxAgeMs() << ", late: " << lateChunks_ << ", required buffer: " << report.getRequiredBufferMs() << "\n";
+	lateChunks_ = 0;
+	clientConnection_->send(&report);
+}
+
+
+void Controller::sendStats()
+{
+	msg::ClientStats stats;
+	stats.bufferMs = std::chrono::duration_cast<chronos::msec>(stream_->getBuffered()).count();
+	stats.medianAgeMs = arrivalAge_.median() / 1000;
+	stats.syncErrorUs = stream_->getLastAge().count();
+	/// player and stream are recreated with a new codec header, their counters start over
+	uint32_t xruns = player_ ? player_->getXruns() : 0;
+	uint32_t resyncs = stream_->getResyncs();
+	stats.xruns = (xruns >= lastXruns_) ? xruns - lastXruns_ : xruns;
+	stats.resyncs = (resyncs >= lastResyncs_) ? resyncs - lastResyncs_ : resyncs;
+	lastXruns_ = xruns;
+	lastResyncs_ = resyncs;
+	stats.decodeUs = (decodedChunks_ > 0) ? decodeUsSum_ / decodedChunks_ : 0;
+	stats.maxDecodeUs = maxDecodeUs_;
+	decodeUsSum_ = 0;
+	maxDecodeUs_ = 0;
+	decodedChunks_ = 0;
+	stats.rttUs = TimeProvider::getInstance().getMedianRtt();
+
+	/// older servers don't know the message
+	if (clientConnection_->getProtocolVersion() >= 5)
+		clientConnection_->send(&stats);
 }
 
 
@@ -140,17 +397,80 @@ bool Controller::sendTimeSyncMessage(long after)
 		return false;
 
 	lastTimeSync = now;
+	sendTimeRequest();
+	return true;
+}
+
+
+void Controller::sendTimeRequest()
+{
+	std::lock_guard<std::mutex> lock(timeSyncMutex_);
+	if (timeSyncClient_)
+	{
+		timeSyncClient_->sendRequest();
+		return;
+	}
 	msg::Time timeReq;
 	clientConnection_->send(&timeReq);
-	return true;
 }
 
 
-void Controller::start(const PcmDevice& pcmDevice, const std::string& host, size_t port, int latency)
+size_t Controller::sendTimeSyncBurst()
+{
+	/// The replies are handled in onMessageReceived or by the TimeSyncClient,
+	/// playback can start as soon as a few of them (i.e. some with low RTT) arrived
+	TimeProvider& timeProvider = TimeProvider::getInstance();
+	size_t samples = timeProvider.getSampleCount();
+	for (size_t n=0; n<timeSyncBurst && active_; ++n)
+	{
+		sendTimeRequest();
+		chronos::usleep(2000);
+	}
+	long burstStart = chronos::getTickCount();
+	while (active_ && (timeProvider.getSampleCount() - samples < timeSyncMinReplies) && (chronos::getTickCount() - burstStart < 2000))
+		chronos::sleep(5);
+	return timeProvider.getSampleCount() - samples;
+}
+
+
+/// Returns the file to persist the time model in, empty if the settings directory can't be created
+static string getTimeModelFilename()
+{
+	string dir;
+	if (getenv("HOME") == NULL)
+		dir = "/var/lib/snapcast/";
+	else
+		dir = getenv("HOME") + string("/.config/snapcast/");
+	int status = mkdirRecursive(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+	if ((status != 0) && (errno != EEXIST))
+	{
+		logE << "failed to create settings directory: \"" << dir << "\": " << errno << "\n";
+		return "";
+	}
+	return dir + "client.json";
+}
+
+
+void Controller::saveTimeModel()
+{
+	if (!timeModelFile_.empty())
+		TimeProvider::getInstance().save(timeModelFile_, server_);
+}
+
+
+void Controller::start(const PcmDevice& pcmDevice, const PlayerSettings& playerSettings, const std::string& host, size_t port, int latency)
 {
 	pcmDevice_ = pcmDevice;
+	playerSettings_ = playerSettings;
 	latency_ = latency;
+	host_ = host;
+	server_ = host + ":" + cpt::to_string(port);
+	timeModelFile_ = getTimeModelFilename();
+	if (!timeModelFile_.empty())
+		TimeProvider::getInstance().load(timeModelFile_, server_);
 	clientConnection_.reset(new ClientConnection(this, host, port));
+	active_ = true;
+	decodeThread_ = thread(&Controller::decoder, this);
 	controllerThread_ = thread(&Controller::worker, this);
 }
 
@@ -159,8 +479,20 @@ void Controller::stop()
 {
 	logD << "Stopping Controller" << endl;
 	active_ = false;
+	{
+		std::lock_guard<std::mutex> lock(decodeMutex_);
+		decodeCv_.notify_one();
+	}
 	controllerThread_.join();
 	clientConnection_->stop();
+	decodeThread_.join();
+	datagramReceiver_.reset();
+	udpReceiver_.reset();
+	{
+		std::lock_guard<std::mutex> lock(timeSyncMutex_);
+		timeSyncClient_.reset();
+	}
+	saveTimeModel();
 }
 
 
@@ -175,20 +507,61 @@ void Controller::worker()
 			clientConnection_->start();
 
 			msg::Hello hello(clientConnection_->getMacAddress());
+			{
+				std::lock_guard<std::mutex> lock(receiveMutex_);
+				udpReceiver_.reset(new DatagramReceiver(this));
+				try
+				{
+					udpReceiver_->start();
+					hello.setUdpPort(udpReceiver_->getPort());
+				}
+				catch (const std::exception& e)
+				{
+					logE << "Failed to open UDP port, receiving chunks via TCP: " << e.what() << "\n";
+					udpReceiver_.reset();
+				}
+			}
+			serverSettingsReceived_ = false;
 			clientConnection_->send(&hello);
 
-			msg::Time timeReq;
-			for (size_t n=0; n<50 && active_; ++n)
+			/// time sync messages carry timestamps, wait for the protocol version
+			long helloSent = chronos::getTickCount();
+			while (active_ && !serverSettingsReceived_ && (chronos::getTickCount() - helloSent < 2000))
+				chronos::sleep(5);
+			if (!serverSettingsReceived_)
+				throw SnapException("no reply to hello");
+
+			if (timeSyncPort_ != 0)
+			{
+				std::lock_guard<std::mutex> lock(timeSyncMutex_);
+				timeSyncClient_.reset(new TimeSyncClient(host_, timeSyncPort_));
+				try
+				{
+					timeSyncClient_->start();
+				}
+				catch (const std::exception& e)
+				{
+					logE << "Failed to start UDP time sync: " << e.what() << "\n";
+					timeSyncClient_.reset();
+				}
+			}
+
+			size_t replies = sendTimeSyncBurst();
+			if ((replies == 0) && active_ && timeSyncClient_)
 			{
-				shared_ptr<msg::Time> reply = clientConnection_->sendReq<msg::Time>(&timeReq, chronos::msec(2000));
-				if (reply)
+				logE << "No UDP time sync replies, using the server connection\n";
 				{
-					TimeProvider::getInstance().setDiff(reply->latency, reply->received - reply->sent);
-					chronos::usleep(100);
+					std::lock_guard<std::mutex> lock(timeSyncMutex_);
+					timeSyncClient_.reset();
 				}
+				replies = sendTimeSyncBurst();
 			}
-			logO << "diff to server [ms]: " << (float)TimeProvider::getInstance().getDiffToServer<chronos::usec>().count() / 1000.f << "\n";
+			if (replies == 0)
+				throw SnapException("no reply to time sync requests");
+			logO << "diff to server [ms]: " << (float)TimeProvider::getInstance().getDiffToServer<chronos::usec>().count() / 1000.f << ", replies: " << replies << "\n";
 
+			long lastSave = chronos::getTickCount();
+			long lastStats = lastSave;
 			while (active_)
 			{
 				for (size_t n=0; n<10 && active_; ++n)
@@ -200,6 +573,21 @@ void Controller::worker()
 
 				if (sendTimeSyncMessage(5000))
 					logO << "time sync main loop\n";
+
+				/// also while no chunks arrive, when xruns and resyncs happen
+				if (chronos::getTickCount() - lastStats >= 5000)
+				{
+					lastStats = chronos::getTickCount();
+					std::lock_guard<std::mutex> lock(receiveMutex_);
+					if (stream_)
+						sendStats();
+				}
+
+				if (chronos::getTickCount() - lastSave > 600000)
+				{
+					saveTimeModel();
+					lastSave = chronos::getTickCount();
+				}
 			}
 		}
 		catch (const std::exception& e)
@@ -207,9 +595,18 @@ void Controller::worker()
 			asyncException_ = false;
 			logS(kLogErr) << "Exception in Controller::worker(): " << e.what() << endl;
 			clientConnection_->stop();
-			player_.reset();
-			stream_.reset();
-			decoder_.reset();
+			{
+				std::lock_guard<std::mutex> lock(timeSyncMutex_);
+				timeSyncClient_.reset();
+			}
+			{
+				std::lock_guard<std::mutex> lock(receiveMutex_);
+				datagramReceiver_.reset();
+				udpReceiver_.reset();
+				player_.reset();
+				stream_.reset();
+				decoder_.reset();
+			}
 			for (size_t n=0; (n<10) && active_; ++n)
 				chronos::sleep(100);
 		}
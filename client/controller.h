@@ -21,10 +21,13 @@
 
 #include <thread>
 #include <atomic>
+#include <condition_variable>
 #include "decoder/decoder.h"
 #include "message/message.h"
 #include "message/serverSettings.h"
 #include "player/pcmDevice.h"
+#include "player/playerSettings.h"
+#include "player/filePlayer.h"
 #ifdef HAS_ALSA
 #include "player/alsaPlayer.h"
 #elif HAS_OPENSL
@@ -33,7 +36,10 @@
 #include "player/coreAudioPlayer.h"
 #endif
 #include "clientConnection.h"
+#include "datagramReceiver.h"
+#include "timeSyncClient.h"
 #include "stream.h"
+#include "common/spscQueue.h"
 
 
 /// Forwards PCM data to the audio player
@@ -41,30 +47,62 @@
  * Sets up a connection to the server (using ClientConnection)
  * Sets up the audio decoder and player. Decodes audio feeds PCM to the audio stream buffer
  * Does timesync with the server
+ * Received messages (except time sync replies) are passed lock-free from the
+ * connection's io thread to a decode thread
+ * If the server sends the chunks as datagrams (multicast or to the announced UDP port),
+ * they are taken from a DatagramReceiver and lost ones are requested from the server.
+ * Multicast repairs arrive on the server connection, unicast repairs as datagrams
  */
-class Controller : public MessageReceiver
+class Controller : public ClientMessageReceiver, DatagramListener
 {
 public:
 	Controller();
-	void start(const PcmDevice& pcmDevice, const std::string& host, size_t port, int latency);
+	void start(const PcmDevice& pcmDevice, const PlayerSettings& playerSettings, const std::string& host, size_t port, int latency);
 	void stop();
 
-	/// Implementation of MessageReceiver.
+	/// Implementation of ClientMessageReceiver.
 	/// ClientConnection passes messages from the server through these callbacks
 	virtual void onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer);
 
-	/// Implementation of MessageReceiver.
+	/// Implementation of ClientMessageReceiver.
 	/// Used for async exception reporting
 	virtual void onException(ClientConnection* connection, const std::exception& exception);
 
+	/// Implementation of DatagramListener
+	virtual void onDatagramData();
+
 private:
 	void worker();
+	void decoder();
+	void processMessage(const msg::BaseMessage& baseMessage, char* buffer);
+	/// Decodes the chunk and adds it to the stream (takes ownership)
+	void addChunk(const msg::BaseMessage& baseMessage, msg::PcmChunk* pcmChunk);
+	/// Switches to the multicast group, the UDP port or the server connection, as given by the ServerSettings
+	void updateTransport(msg::ServerSettings& serverSettings);
+	/// Processes the next datagram chunk, requests lost ones
+	bool processDatagrams();
+	/// Chunks with a timestamp (server time) up to this must be decoded now to be played in time
+	tv getDue() const;
 	bool sendTimeSyncMessage(long after = 1000);
+	/// Sends a time request via UDP, if available, or on the server connection
+	void sendTimeRequest();
+	/// Burst of pipelined time requests, returns the number of replies
+	size_t sendTimeSyncBurst();
+	void saveTimeModel();
+	/// Measures the chunk arrival age and periodically sends a JitterReport
+	void updateJitter(const msg::BaseMessage& baseMessage, const msg::PcmChunk& chunk);
+	/// Sends the ClientStats of the last interval, every 5s from the worker, receiveMutex_ must be locked
+	void sendStats();
 	std::atomic<bool> active_;
 	std::thread controllerThread_;
 	SampleFormat sampleFormat_;
 	PcmDevice pcmDevice_;
+	PlayerSettings playerSettings_;
 	int latency_;
+	std::string host_;
+	/// "host:port", the time model is persisted per server
+	std::string server_;
+	std::string timeModelFile_;
 	std::unique_ptr<ClientConnection> clientConnection_;
 	std::shared_ptr<Stream> stream_;
 	std::unique_ptr<Decoder> decoder_;
@@ -73,6 +111,32 @@ private:
 	std::shared_ptr<msg::CodecHeader> headerChunk_;
 	std::mutex receiveMutex_;
 
+	std::thread decodeThread_;
+	SpscQueue<std::unique_ptr<msg::SerializedMessage>> messages_;
+	std::mutex decodeMutex_;
+	std::condition_variable decodeCv_;
+	std::atomic<bool> decodeWaiting_;
+	/// receiver the chunks are taken from, null: server connection
+	std::unique_ptr<DatagramReceiver> datagramReceiver_;
+	/// unicast receiver announced in the Hello, until the server enables it
+	std::unique_ptr<DatagramReceiver> udpReceiver_;
+	std::atomic<bool> datagramPending_;
+
+	/// arrival age of the last 500 chunks [us]
+	DoubleBuffer<chronos::usec::rep> arrivalAge_;
+	uint32_t lateChunks_;
+	long lastJitterReport_;
+	uint64_t decodeUsSum_;
+	uint64_t maxDecodeUs_;
+	uint32_t decodedChunks_;
+	uint32_t lastXruns_;
+	uint32_t lastResyncs_;
+
+	/// set on the connection's io thread, the worker waits for it before time sync
+	std::atomic<bool> serverSettingsReceived_;
+	std::atomic<uint16_t> timeSyncPort_;
+	std::mutex timeSyncMutex_;
+	std::unique_ptr<TimeSyncClient> timeSyncClient_;
 	std::string exception_;
 	bool asyncException_;
 };
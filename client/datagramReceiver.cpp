@@ -0,0 +1,170 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sstream>
+#include "datagramReceiver.h"
+#include "common/log.h"
+#include "common/snapException.h"
+#include "common/strCompat.h"
+#include "common/timeDefs.h"
+
+using namespace std;
+
+
+/// A received message (header and payload) that can be serialized again
+class RawMessage : public msg::BaseMessage
+{
+public:
+	RawMessage(const msg::BaseMessage& baseMessage, const char* payload) : msg::BaseMessage(baseMessage), payload_(payload), payloadSize_(baseMessage.size)
+	{
+	}
+
+	virtual uint32_t getSize() const
+	{
+		return payloadSize_;
+	}
+
+protected:
+	virtual void doserialize(std::ostream& stream, uint16_t protocolVersion) const
+	{
+		stream.write(payload_, payloadSize_);
+	}
+
+	const char* payload_;
+	uint32_t payloadSize_;
+};
+
+
+
+DatagramReceiver::DatagramReceiver(DatagramListener* listener, const std::string& endpoint) :
+	listener_(listener), endpoint_(endpoint), socket_(ioService_), active_(false)
+{
+}
+
+
+DatagramReceiver::~DatagramReceiver()
+{
+	stop();
+}
+
+
+void DatagramReceiver::start()
+{
+	if (isMulticast())
+	{
+		size_t pos = endpoint_.rfind(':');
+		if (pos == string::npos)
+			throw SnapException("Invalid multicast endpoint: " + endpoint_);
+		asio::ip::address group = asio::ip::address::from_string(endpoint_.substr(0, pos));
+		udp::endpoint listenEndpoint(group.is_v6() ? udp::v6() : udp::v4(), cpt::stoul(endpoint_.substr(pos + 1)));
+
+		socket_.open(listenEndpoint.protocol());
+		socket_.set_option(udp::socket::reuse_address(true));
+		/// a chunk is up to a few hundred kB in flight
+		socket_.set_option(asio::socket_base::receive_buffer_size(1024*1024));
+		socket_.bind(listenEndpoint);
+		socket_.set_option(asio::ip::multicast::join_group(group));
+		logO << "Joined multicast group " << endpoint_ << "\n";
+	}
+	else
+	{
+		socket_.open(udp::v4());
+		socket_.set_option(asio::socket_base::receive_buffer_size(1024*1024));
+		socket_.bind(udp::endpoint(udp::v4(), 0));
+		logO << "Listening for chunks on UDP port " << getPort() << "\n";
+	}
+
+	active_ = true;
+	readerThread_ = thread(&DatagramReceiver::reader, this);
+}
+
+
+uint16_t DatagramReceiver::getPort() const
+{
+	return socket_.local_endpoint().port();
+}
+
+
+void DatagramReceiver::stop()
+{
+	if (!active_)
+		return;
+	active_ = false;
+	std::error_code ec;
+	/// wakes up the blocking receive
+	socket_.shutdown(udp::socket::shutdown_both, ec);
+	socket_.close(ec);
+	readerThread_.join();
+}
+
+
+void DatagramReceiver::reader()
+{
+	vector<char> buffer(datagram::headerSize + datagram::fragmentHeaderSize + datagram::maxPayload);
+	while (active_)
+	{
+		std::error_code ec;
+		size_t size = socket_.receive(asio::buffer(buffer), 0, ec);
+		if (!active_)
+			break;
+		if (ec)
+		{
+			logE << "Datagram receive error: " << ec.message() << "\n";
+			chronos::sleep(100);
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(decoderMutex_);
+			decoder_.add(buffer.data(), size, tv());
+		}
+		listener_->onDatagramData();
+	}
+	std::lock_guard<std::mutex> lock(decoderMutex_);
+	logD << "Datagram reader stopped, recovered: " << decoder_.getRecovered() << ", lost: " << decoder_.getLost() << "\n";
+}
+
+
+bool DatagramReceiver::getNextMessage(datagram::Message& message, const tv& due)
+{
+	std::lock_guard<std::mutex> lock(decoderMutex_);
+	return decoder_.pop(message, due);
+}
+
+
+void DatagramReceiver::addRepair(const msg::BaseMessage& baseMessage, const char* buffer)
+{
+	datagram::Message message;
+	message.received = baseMessage.received;
+	RawMessage rawMessage(baseMessage, buffer);
+	std::ostringstream stream;
+	rawMessage.serialize(stream, msg::protocolVersion);
+	string data = stream.str();
+	message.data.assign(data.begin(), data.end());
+
+	std::lock_guard<std::mutex> lock(decoderMutex_);
+	decoder_.addRepair(decoder_.expand(baseMessage.id), std::move(message));
+}
+
+
+std::vector<uint32_t> DatagramReceiver::getMissing(const tv& due, const tv& repairLead)
+{
+	std::lock_guard<std::mutex> lock(decoderMutex_);
+	return decoder_.getMissing(due, repairLead);
+}
+
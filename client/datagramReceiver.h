@@ -0,0 +1,95 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef DATAGRAM_RECEIVER_H
+#define DATAGRAM_RECEIVER_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <asio.hpp>
+#include "message/message.h"
+#include "common/chunkDatagram.h"
+
+
+using asio::ip::udp;
+
+
+/// Interface: new data is available via DatagramReceiver::getNextMessage
+class DatagramListener
+{
+public:
+	virtual void onDatagramData() = 0;
+};
+
+
+/// Receives the chunks of a stream as datagrams
+/**
+ * Joins the multicast group "group:port" (see ServerSettings::getMulticast) or, without endpoint,
+ * listens on an ephemeral UDP port that is announced to the server (see Hello::setUdpPort).
+ * Reassembles the chunks with DatagramDecoder on a reader thread. Chunks are returned in order,
+ * lost ones can be requested (msg::ChunkRequest). Multicast repairs are passed in with addRepair,
+ * unicast repairs arrive as datagrams
+ */
+class DatagramReceiver
+{
+public:
+	DatagramReceiver(DatagramListener* listener, const std::string& endpoint = "");
+	~DatagramReceiver();
+
+	void start();
+	void stop();
+
+	/// Multicast "group:port", empty for unicast
+	const std::string& getEndpoint() const
+	{
+		return endpoint_;
+	}
+
+	bool isMulticast() const
+	{
+		return !endpoint_.empty();
+	}
+
+	/// Local port, valid after start
+	uint16_t getPort() const;
+
+	/// Next chunk (serialized message) in order, lost chunks are skipped once the next one is due
+	bool getNextMessage(datagram::Message& message, const tv& due);
+	/// A chunk that was resent over the server connection, its id is the chunk number
+	void addRepair(const msg::BaseMessage& baseMessage, const char* buffer);
+	/// Chunks that should be requested from the server, see DatagramDecoder::getMissing
+	std::vector<uint32_t> getMissing(const tv& due, const tv& repairLead);
+
+private:
+	void reader();
+
+	DatagramListener* listener_;
+	std::string endpoint_;
+	asio::io_service ioService_;
+	udp::socket socket_;
+	std::atomic<bool> active_;
+	std::thread readerThread_;
+	std::mutex decoderMutex_;
+	DatagramDecoder decoder_;
+};
+
+
+#endif
@@ -0,0 +1,157 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "common/endian.h"
+#include "common/deltaCodec.h"
+#include "common/log.h"
+#include "deltaDecoder.h"
+
+
+DeltaDecoder::DeltaDecoder() : PcmDecoder()
+{
+}
+
+
+SampleFormat DeltaDecoder::setHeader(msg::CodecHeader* chunk)
+{
+	sampleFormat_ = PcmDecoder::setHeader(chunk);
+	return sampleFormat_;
+}
+
+
+bool DeltaDecoder::decode(msg::PcmChunk* chunk)
+{
+	const uint8_t* in = (const uint8_t*)chunk->payload;
+	const uint8_t* end = in + chunk->payloadSize;
+	if (chunk->payloadSize < sizeof(uint32_t))
+		return false;
+
+	uint32_t frames;
+	memcpy(&frames, in, sizeof(frames));
+	frames = SWAP_32(frames);
+	in += sizeof(uint32_t);
+	/// every block carries at least one byte per channel
+	if ((frames + delta::blockFrames - 1) / delta::blockFrames * sampleFormat_.channels > chunk->payloadSize)
+		return false;
+
+	size_t size = (size_t)frames * sampleFormat_.frameSize;
+	char* pcm = (char*)malloc(size);
+	bool ok(false);
+	if (sampleFormat_.sampleSize == 1)
+		ok = decodeSamples<int8_t>(in, end, frames, (int8_t*)pcm);
+	else if (sampleFormat_.sampleSize == 2)
+		ok = decodeSamples<int16_t>(in, end, frames, (int16_t*)pcm);
+	else if (sampleFormat_.sampleSize == 4)
+		ok = decodeSamples<int32_t>(in, end, frames, (int32_t*)pcm);
+
+	if (!ok)
+	{
+		logE << "Failed to decode delta chunk\n";
+		free(pcm);
+		return false;
+	}
+
+	free(chunk->payload);
+	chunk->payload = pcm;
+	chunk->payloadSize = size;
+	return true;
+}
+
+
+template<typename T>
+bool DeltaDecoder::decodeSamples(const uint8_t* in, const uint8_t* end, uint32_t frames, T* samples)
+{
+	uint16_t channels = sampleFormat_.channels;
+	if (frames == 0)
+		return true;
+	if (in + channels * sizeof(int32_t) > end)
+		return false;
+
+	/// prediction history, warmed up with the first sample
+	std::vector<int64_t> prev1(channels);
+	std::vector<int64_t> prev2(channels);
+	for (uint16_t c = 0; c < channels; ++c)
+	{
+		int32_t warmup;
+		memcpy(&warmup, in, sizeof(warmup));
+		prev1[c] = prev2[c] = (int32_t)SWAP_32(warmup);
+		in += sizeof(int32_t);
+	}
+
+	for (uint32_t blockStart = 0; blockStart < frames; blockStart += delta::blockFrames)
+	{
+		uint32_t n = std::min(delta::blockFrames, frames - blockStart);
+		for (uint16_t c = 0; c < channels; ++c)
+		{
+			if (in >= end)
+				return false;
+			uint8_t order = *in >> delta::orderShift;
+			uint8_t width = *in & delta::widthMask;
+			++in;
+			if ((width > 8 * sizeof(T) + 3) || ((order != 1) && (order != 2)))
+				return false;
+			if (in + (n * width + 7) / 8 > end)
+				return false;
+
+			T* s = samples + (size_t)blockStart * channels + c;
+			int64_t p1 = prev1[c];
+			int64_t p2 = prev2[c];
+			if (width == 0)
+			{
+				/// constant (order 1) or linear (order 2) block, e.g. silence
+				for (uint32_t i = 0; i < n; ++i)
+				{
+					int64_t x = (order == 2) ? 2*p1 - p2 : p1;
+					s[(size_t)i * channels] = endian::swap<T>((T)x);
+					p2 = p1;
+					p1 = x;
+				}
+			}
+			else
+			{
+				uint64_t mask = ((uint64_t)1 << width) - 1;
+				uint64_t acc = 0;
+				uint8_t bits = 0;
+				for (uint32_t i = 0; i < n; ++i)
+				{
+					while (bits < width)
+					{
+						acc |= (uint64_t)(*in++) << bits;
+						bits += 8;
+					}
+					int64_t residual = delta::unzigzag(acc & mask);
+					acc >>= width;
+					bits -= width;
+					int64_t x = ((order == 2) ? 2*p1 - p2 : p1) + residual;
+					s[(size_t)i * channels] = endian::swap<T>((T)x);
+					p2 = p1;
+					p1 = x;
+				}
+			}
+			prev1[c] = p1;
+			prev2[c] = p2;
+		}
+	}
+	return true;
+}
+
+
@@ -0,0 +1,46 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef DELTA_DECODER_H
+#define DELTA_DECODER_H
+#include "pcmDecoder.h"
+
+
+/// Decoder for the lossless "delta" codec
+/**
+ * The header is a PCM RIFF header, which is parsed by the PcmDecoder.
+ * See common/deltaCodec.h for the chunk layout.
+ */
+class DeltaDecoder : public PcmDecoder
+{
+public:
+	DeltaDecoder();
+	virtual bool decode(msg::PcmChunk* chunk);
+	virtual SampleFormat setHeader(msg::CodecHeader* chunk);
+
+private:
+	template<typename T>
+	bool decodeSamples(const uint8_t* in, const uint8_t* end, uint32_t frames, T* samples);
+
+	SampleFormat sampleFormat_;
+};
+
+
+#endif
+
+
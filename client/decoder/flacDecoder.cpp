@@ -16,6 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include <cmath>
@@ -28,31 +29,17 @@
 using namespace std;
 
 
-static FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data);
-static FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data);
-static void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data);
-static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
-
-
-static msg::CodecHeader* flacHeader = NULL;
-static msg::PcmChunk* flacChunk = NULL;
-static msg::PcmChunk* pcmChunk = NULL;
-static SampleFormat sampleFormat;
-static FLAC__StreamDecoder *decoder = NULL;
-
-
-
-FlacDecoder::FlacDecoder() : Decoder(), lastError_(nullptr)
+FlacDecoder::FlacDecoder() : Decoder(), lastError_(nullptr), decoder_(NULL), readPos_(NULL), readAvailable_(0), pcmBuffer_(NULL), pcmCapacity_(0), pcmSize_(0), lastPcmSize_(0)
 {
-	flacChunk = new msg::PcmChunk();
 }
 
 
 FlacDecoder::~FlacDecoder()
 {
 	std::lock_guard<std::mutex> lock(mutex_);
-	delete flacChunk;
-	delete decoder;
+	if (decoder_ != NULL)
+		FLAC__stream_decoder_delete(decoder_);
+	free(pcmBuffer_);
 }
 
 
@@ -60,17 +47,17 @@ bool FlacDecoder::decode(msg::PcmChunk* chunk)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 	cacheInfo_.reset();
-	pcmChunk = chunk;
-	flacChunk->payload = (char*)realloc(flacChunk->payload, chunk->payloadSize);
-	memcpy(flacChunk->payload, chunk->payload, chunk->payloadSize);
-	flacChunk->payloadSize = chunk->payloadSize;
-
-	pcmChunk->payload = (char*)realloc(pcmChunk->payload, 0);
-	pcmChunk->payloadSize = 0;
-	while (flacChunk->payloadSize > 0)
+	readPos_ = chunk->payload;
+	readAvailable_ = chunk->payloadSize;
+	pcmSize_ = 0;
+	/// chunks have about the same duration, size the output buffer once
+	reservePcm(lastPcmSize_);
+
+	while (readAvailable_ > 0)
 	{
-		if (!FLAC__stream_decoder_process_single(decoder))
+		if (!FLAC__stream_decoder_process_single(decoder_))
 		{
+			readAvailable_ = 0;
 			return false;
 		}
 
@@ -78,10 +65,22 @@ bool FlacDecoder::decode(msg::PcmChunk* chunk)
 		{
 			logE << "FLAC decode error: " << FLAC__StreamDecoderErrorStatusString[*lastError_] << "\n";
 			lastError_= nullptr;
+			readAvailable_ = 0;
 			return false;
 		}
 	}
 
+	/// Hand the decoded PCM over to the chunk without copying, the chunk's
+	/// encoded payload (and its capacity) becomes the next output buffer
+	char* encoded = chunk->payload;
+	size_t encodedSize = chunk->payloadSize;
+	chunk->payload = pcmBuffer_;
+	chunk->payloadSize = pcmSize_;
+	pcmBuffer_ = encoded;
+	pcmCapacity_ = encodedSize;
+	lastPcmSize_ = pcmSize_;
+	pcmSize_ = 0;
+
 	if ((cacheInfo_.cachedBlocks_ > 0) && (cacheInfo_.sampleRate_ != 0))
 	{
 		double diffMs = cacheInfo_.cachedBlocks_ / ((double)cacheInfo_.sampleRate_ / 1000.);
@@ -97,109 +96,122 @@ bool FlacDecoder::decode(msg::PcmChunk* chunk)
 
 SampleFormat FlacDecoder::setHeader(msg::CodecHeader* chunk)
 {
-	flacHeader = chunk;
+	std::lock_guard<std::mutex> lock(mutex_);
 	FLAC__StreamDecoderInitStatus init_status;
 
-	if ((decoder = FLAC__stream_decoder_new()) == NULL)
+	if (decoder_ != NULL)
+		FLAC__stream_decoder_delete(decoder_);
+
+	if ((decoder_ = FLAC__stream_decoder_new()) == NULL)
 		throw SnapException("ERROR: allocating decoder");
 
-//	(void)FLAC__stream_decoder_set_md5_checking(decoder, true);
-	init_status = FLAC__stream_decoder_init_stream(decoder, read_callback, NULL, NULL, NULL, NULL, write_callback, metadata_callback, error_callback, this);
+//	(void)FLAC__stream_decoder_set_md5_checking(decoder_, true);
+	init_status = FLAC__stream_decoder_init_stream(decoder_, read_callback, NULL, NULL, NULL, NULL, write_callback, metadata_callback, error_callback, this);
 	if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK)
 		throw SnapException("ERROR: initializing decoder: " + string(FLAC__StreamDecoderInitStatusString[init_status]));
 
-	sampleFormat.rate = 0;
-	FLAC__stream_decoder_process_until_end_of_metadata(decoder);
-	if (sampleFormat.rate == 0)
+	sampleFormat_.rate = 0;
+	readPos_ = chunk->payload;
+	readAvailable_ = chunk->payloadSize;
+	FLAC__stream_decoder_process_until_end_of_metadata(decoder_);
+	readAvailable_ = 0;
+	if (sampleFormat_.rate == 0)
 		throw SnapException("Sample format not found");
 
-	return sampleFormat;
+	return sampleFormat_;
 }
 
 
-FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
+void FlacDecoder::reservePcm(size_t size)
 {
-	if (flacHeader != NULL)
+	if (size <= pcmCapacity_)
+		return;
+	pcmCapacity_ = std::max(size, 2 * pcmCapacity_);
+	if (pcmSize_ == 0)
 	{
-		*bytes = flacHeader->payloadSize;
-		memcpy(buffer, flacHeader->payload, *bytes);
-		flacHeader = NULL;
+		/// nothing decoded yet: don't copy the recycled encoded payload
+		free(pcmBuffer_);
+		pcmBuffer_ = (char*)malloc(pcmCapacity_);
 	}
-	else if (flacChunk != NULL)
+	else
+		pcmBuffer_ = (char*)realloc(pcmBuffer_, pcmCapacity_);
+}
+
+
+template<typename T>
+void FlacDecoder::deinterleave(const FLAC__int32 * const buffer[], size_t frames, T* out) const
+{
+	for (size_t channel = 0; channel < sampleFormat_.channels; ++channel)
 	{
-//		cerr << "read_callback: " << *bytes << ", avail: " << flacChunk->payloadSize << "\n";
-		static_cast<FlacDecoder*>(client_data)->cacheInfo_.isCachedChunk_ = false;
-		if (*bytes > flacChunk->payloadSize)
-			*bytes = flacChunk->payloadSize;
-
-//		if (*bytes == 0)
-//			return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
-
-		memcpy(buffer, flacChunk->payload, *bytes);
-		memmove(flacChunk->payload, flacChunk->payload + *bytes, flacChunk->payloadSize - *bytes);
-		flacChunk->payloadSize = flacChunk->payloadSize - *bytes;
-		flacChunk->payload = (char*)realloc(flacChunk->payload, flacChunk->payloadSize);
+		const FLAC__int32* in = buffer[channel];
+		for (size_t i = 0; i < frames; i++)
+			out[sampleFormat_.channels*i + channel] = endian::swap<T>((T)in[i]);
 	}
-	return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
 }
 
 
-FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+FLAC__StreamDecoderReadStatus FlacDecoder::read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
 {
-	(void)decoder;
+	FlacDecoder* flacDecoder = static_cast<FlacDecoder*>(client_data);
+//	cerr << "read_callback: " << *bytes << ", avail: " << flacDecoder->readAvailable_ << "\n";
+	if (flacDecoder->readAvailable_ > 0)
+		flacDecoder->cacheInfo_.isCachedChunk_ = false;
 
-	if (pcmChunk != NULL)
-	{
-		size_t bytes = frame->header.blocksize * sampleFormat.frameSize;
+	if (*bytes > flacDecoder->readAvailable_)
+		*bytes = flacDecoder->readAvailable_;
 
-		FlacDecoder* flacDecoder = static_cast<FlacDecoder*>(client_data);
-		if (flacDecoder->cacheInfo_.isCachedChunk_)
-			flacDecoder->cacheInfo_.cachedBlocks_ += frame->header.blocksize;
+//	if (*bytes == 0)
+//		return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
 
-		pcmChunk->payload = (char*)realloc(pcmChunk->payload, pcmChunk->payloadSize + bytes);
+	memcpy(buffer, flacDecoder->readPos_, *bytes);
+	flacDecoder->readPos_ += *bytes;
+	flacDecoder->readAvailable_ -= *bytes;
+	return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+
+FLAC__StreamDecoderWriteStatus FlacDecoder::write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	(void)decoder;
+	FlacDecoder* flacDecoder = static_cast<FlacDecoder*>(client_data);
+	const SampleFormat& sampleFormat = flacDecoder->sampleFormat_;
+	size_t bytes = frame->header.blocksize * sampleFormat.frameSize;
 
-		for (size_t channel = 0; channel < sampleFormat.channels; ++channel)
+	if (flacDecoder->cacheInfo_.isCachedChunk_)
+		flacDecoder->cacheInfo_.cachedBlocks_ += frame->header.blocksize;
+
+	for (size_t channel = 0; channel < sampleFormat.channels; ++channel)
+	{
+		if (buffer[channel] == NULL)
 		{
-			if (buffer[channel] == NULL)
-			{
-				logS(kLogErr) << "ERROR: buffer[" << channel << "] is NULL\n";
-				return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
-			}
-			
-			if (sampleFormat.sampleSize == 1)
-			{
-				int8_t* chunkBuffer = (int8_t*)(pcmChunk->payload + pcmChunk->payloadSize);
-				for (size_t i = 0; i < frame->header.blocksize; i++)
-					chunkBuffer[sampleFormat.channels*i + channel] = (int8_t)(buffer[channel][i]);
-			}
-			else if (sampleFormat.sampleSize == 2)
-			{
-				int16_t* chunkBuffer = (int16_t*)(pcmChunk->payload + pcmChunk->payloadSize);
-				for (size_t i = 0; i < frame->header.blocksize; i++)
-					chunkBuffer[sampleFormat.channels*i + channel] = SWAP_16((int16_t)(buffer[channel][i]));
-			}
-			else if (sampleFormat.sampleSize == 4)
-			{
-				int32_t* chunkBuffer = (int32_t*)(pcmChunk->payload + pcmChunk->payloadSize);
-				for (size_t i = 0; i < frame->header.blocksize; i++)
-					chunkBuffer[sampleFormat.channels*i + channel] = SWAP_32((int32_t)(buffer[channel][i]));
-			}
+			logS(kLogErr) << "ERROR: buffer[" << channel << "] is NULL\n";
+			return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 		}
-		pcmChunk->payloadSize += bytes;
 	}
 
+	flacDecoder->reservePcm(flacDecoder->pcmSize_ + bytes);
+	char* out = flacDecoder->pcmBuffer_ + flacDecoder->pcmSize_;
+	if (sampleFormat.sampleSize == 1)
+		flacDecoder->deinterleave<int8_t>(buffer, frame->header.blocksize, (int8_t*)out);
+	else if (sampleFormat.sampleSize == 2)
+		flacDecoder->deinterleave<int16_t>(buffer, frame->header.blocksize, (int16_t*)out);
+	else if (sampleFormat.sampleSize == 4)
+		flacDecoder->deinterleave<int32_t>(buffer, frame->header.blocksize, (int32_t*)out);
+	flacDecoder->pcmSize_ += bytes;
+
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
 
-void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data)
+void FlacDecoder::metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data)
 {
 	(void)decoder;
 	/* print some stats */
 	if(metadata->type == FLAC__METADATA_TYPE_STREAMINFO)
 	{
-		static_cast<FlacDecoder*>(client_data)->cacheInfo_.sampleRate_ = metadata->data.stream_info.sample_rate;
-		sampleFormat.setFormat(
+		FlacDecoder* flacDecoder = static_cast<FlacDecoder*>(client_data);
+		flacDecoder->cacheInfo_.sampleRate_ = metadata->data.stream_info.sample_rate;
+		flacDecoder->sampleFormat_.setFormat(
 			metadata->data.stream_info.sample_rate,
 			metadata->data.stream_info.bits_per_sample,
 			metadata->data.stream_info.channels);
@@ -207,9 +219,9 @@ void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMet
 }
 
 
-void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+void FlacDecoder::error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
 {
-	(void)decoder, (void)client_data;
+	(void)decoder;
 	logS(kLogErr) << "Got error callback: " << FLAC__StreamDecoderErrorStatusString[status] << "\n";
 	static_cast<FlacDecoder*>(client_data)->lastError_ = std::unique_ptr<FLAC__StreamDecoderErrorStatus>(new FLAC__StreamDecoderErrorStatus(status));
 
@@ -223,8 +235,3 @@ void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderError
 	// Oct 27 17:47:13 kitchen snapclient[869]: Got error callback: FLAC__STREAM_DECODER_ERROR_STATUS_UNPARSEABLE_STREAM
 	// Oct 27 17:47:13 kitchen snapclient[869]: Got error callback: FLAC__STREAM_DECODER_ERROR_STATUS_LOST_SYNC
 }
-
-
-
-
-
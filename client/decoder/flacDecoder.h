@@ -46,6 +46,14 @@ struct CacheInfo
 };
 
 
+/// FLAC decoder
+/**
+ * All decoding state is kept per instance, the libFLAC callbacks get the
+ * instance as client data.
+ * Encoded data is read through a cursor over the chunk's payload and
+ * decoded PCM is written into a buffer that is swapped into the chunk
+ * when decoding is done, no PCM is copied.
+ */
 class FlacDecoder : public Decoder
 {
 public:
@@ -56,6 +64,30 @@ public:
 
 	CacheInfo cacheInfo_;
 	std::unique_ptr<FLAC__StreamDecoderErrorStatus> lastError_;
+
+private:
+	static FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data);
+	static FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data);
+	static void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data);
+	static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
+
+	template<typename T>
+	void deinterleave(const FLAC__int32 * const buffer[], size_t frames, T* out) const;
+
+	void reservePcm(size_t size);
+
+	FLAC__StreamDecoder* decoder_;
+	SampleFormat sampleFormat_;
+
+	/// encoded data not yet passed to libFLAC
+	const char* readPos_;
+	size_t readAvailable_;
+
+	/// decoded PCM of the current chunk
+	char* pcmBuffer_;
+	size_t pcmCapacity_;
+	size_t pcmSize_;
+	size_t lastPcmSize_; /// PCM size of the last chunk
 };
 
 
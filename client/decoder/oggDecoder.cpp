@@ -16,6 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include <cmath>
@@ -29,7 +30,7 @@
 using namespace std;
 
 
-OggDecoder::OggDecoder() : Decoder()
+OggDecoder::OggDecoder() : Decoder(), lastGranulepos_(-1), pcmBuffer_(NULL), pcmCapacity_(0), pcmSize_(0), lastPcmSize_(0)
 {
 	ogg_sync_init(&oy); /* Now we can read pages */
 }
@@ -44,6 +45,54 @@ OggDecoder::~OggDecoder()
 	vorbis_comment_clear(&vc);
 	vorbis_info_clear(&vi);  /* must be called last */
 	ogg_sync_clear(&oy);
+	free(pcmBuffer_);
+}
+
+
+/// Convert a float sample to fixed point: floor(value * scale + .5), clipped to [-offset, offset - 1]
+/**
+ * Written without floating point compares and floor(), so that the loops in
+ * interleave can be vectorized: shifted by offset the value is not negative,
+ * so the truncating conversion rounds down. The result is clipped as integer.
+ */
+template<typename F, typename I>
+static inline I toFixed(F value, F scale, I offset)
+{
+	I v = (I)(value * scale + ((F)offset + (F).5)) - offset;
+	v = (v < -offset) ? -offset : v;
+	return (v > offset - 1) ? offset - 1 : v;
+}
+
+
+/// Interleave the planar decoder output into "out", converting every sample
+template<typename T, typename S, typename Convert>
+static void interleave(S** pcm, int channels, int frames, T* out, Convert convert)
+{
+	if (channels == 2)
+	{
+		const S* left = pcm[0];
+		const S* right = pcm[1];
+		for (int i = 0; i < frames; ++i)
+		{
+			out[2*i] = convert(left[i]);
+			out[2*i + 1] = convert(right[i]);
+		}
+	}
+	else if (channels == 1)
+	{
+		const S* mono = pcm[0];
+		for (int i = 0; i < frames; ++i)
+			out[i] = convert(mono[i]);
+	}
+	else
+	{
+		for (int channel = 0; channel < channels; ++channel)
+		{
+			const S* in = pcm[channel];
+			for (int i = 0; i < frames; ++i)
+				out[channels*i + channel] = convert(in[i]);
+		}
+	}
 }
 
 
@@ -59,8 +108,9 @@ bool OggDecoder::decode(msg::PcmChunk* chunk)
 	memcpy(buffer, chunk->payload, size);
 	ogg_sync_wrote(&oy, size);
 
-
-	chunk->payloadSize = 0;
+	pcmSize_ = 0;
+	/// chunks have about the same duration, size the output buffer once
+	reservePcm(lastPcmSize_);
 	/* The rest is just a straight decode loop until end of stream */
 	//      while(!eos){
 	while(true)
@@ -75,6 +125,16 @@ bool OggDecoder::decode(msg::PcmChunk* chunk)
 			continue;
 		}
 
+		/// The granule delta of a page is the number of frames that will be
+		/// decoded from it, reserve the output space upfront
+		ogg_int64_t granulepos = ogg_page_granulepos(&og);
+		if (granulepos >= 0)
+		{
+			if ((lastGranulepos_ >= 0) && (granulepos > lastGranulepos_))
+				reservePcm(pcmSize_ + (granulepos - lastGranulepos_) * sampleFormat_.frameSize);
+			lastGranulepos_ = granulepos;
+		}
+
 		ogg_stream_pagein(&os,&og); /* can safely ignore errors at this point */
 		while(1)
 		{
@@ -103,60 +163,70 @@ bool OggDecoder::decode(msg::PcmChunk* chunk)
 			while ((samples = vorbis_synthesis_pcmout(&vd, &pcm)) > 0)
 			{
 				size_t bytes = sampleFormat_.sampleSize * vi.channels * samples;
-				chunk->payload = (char*)realloc(chunk->payload, chunk->payloadSize + bytes);
-				for (int channel = 0; channel < vi.channels; ++channel)
+				reservePcm(pcmSize_ + bytes);
+				char* out = pcmBuffer_ + pcmSize_;
+				if (sampleFormat_.sampleSize == 1)
 				{
-					if (sampleFormat_.sampleSize == 1)
-					{
-						int8_t* chunkBuffer = (int8_t*)(chunk->payload + chunk->payloadSize);
-						for (int i = 0; i < samples; i++)
-						{
-							int8_t& val = chunkBuffer[sampleFormat_.channels*i + channel];
 #ifdef HAS_TREMOR
-							val = clip<int8_t>(pcm[channel][i], -128, 127);
+					interleave(pcm, vi.channels, samples, (int8_t*)out, [this](ogg_int32_t value) { return (int8_t)clip<ogg_int32_t>(value >> 17, -128, 127); });
 #else
-							val = clip<int8_t>(floor(pcm[channel][i]*127.f + .5f), -128, 127);
+					interleave(pcm, vi.channels, samples, (int8_t*)out, [](float value) { return (int8_t)toFixed<float, int32_t>(value, 127.f, 128); });
 #endif
-						}
-					}
-					else if (sampleFormat_.sampleSize == 2)
-					{
-						int16_t* chunkBuffer = (int16_t*)(chunk->payload + chunk->payloadSize);
-						for (int i = 0; i < samples; i++)
-						{
-							int16_t& val = chunkBuffer[sampleFormat_.channels*i + channel];
+				}
+				else if (sampleFormat_.sampleSize == 2)
+				{
 #ifdef HAS_TREMOR
-							val = SWAP_16(clip<int16_t>(pcm[channel][i] >> 9, -32768, 32767));
+					interleave(pcm, vi.channels, samples, (int16_t*)out, [this](ogg_int32_t value) { return endian::swap<int16_t>(clip<ogg_int32_t>(value >> 9, -32768, 32767)); });
 #else
-							val = SWAP_16(clip<int16_t>(floor(pcm[channel][i]*32767.f + .5f), -32768, 32767));
+					interleave(pcm, vi.channels, samples, (int16_t*)out, [](float value) { return endian::swap<int16_t>(toFixed<float, int32_t>(value, 32767.f, 32768)); });
 #endif
-						}
-					}
-					else if (sampleFormat_.sampleSize == 4)
-					{
-						int32_t* chunkBuffer = (int32_t*)(chunk->payload + chunk->payloadSize);
-						for (int i = 0; i < samples; i++)
-						{
-							int32_t& val = chunkBuffer[sampleFormat_.channels*i + channel];
+				}
+				else if (sampleFormat_.sampleSize == 4)
+				{
 #ifdef HAS_TREMOR
-							val = SWAP_32(clip<int32_t>(pcm[channel][i] << 7, -2147483648, 2147483647));
+					interleave(pcm, vi.channels, samples, (int32_t*)out, [this](ogg_int32_t value) { return endian::swap<int32_t>(clip<ogg_int64_t>((ogg_int64_t)value << 7, -2147483648LL, 2147483647LL)); });
 #else
-							val = SWAP_32(clip<int32_t>(floor(pcm[channel][i]*2147483647.f + .5f), -2147483648, 2147483647));
+					interleave(pcm, vi.channels, samples, (int32_t*)out, [](float value) { return endian::swap<int32_t>(toFixed<double, int64_t>(value, 2147483647., 2147483648LL)); });
 #endif
-						}
-					}
 				}
 
-				chunk->payloadSize += bytes;
+				pcmSize_ += bytes;
 				vorbis_synthesis_read(&vd, samples);
 			}
 		}
 	}
 
+	/// Hand the decoded PCM over to the chunk without copying, the chunk's
+	/// encoded payload (and its capacity) becomes the next output buffer
+	char* encoded = chunk->payload;
+	size_t encodedSize = chunk->payloadSize;
+	chunk->payload = pcmBuffer_;
+	chunk->payloadSize = pcmSize_;
+	pcmBuffer_ = encoded;
+	pcmCapacity_ = encodedSize;
+	lastPcmSize_ = pcmSize_;
+	pcmSize_ = 0;
+
 	return true;
 }
 
 
+void OggDecoder::reservePcm(size_t size)
+{
+	if (size <= pcmCapacity_)
+		return;
+	pcmCapacity_ = std::max(size, 2 * pcmCapacity_);
+	if (pcmSize_ == 0)
+	{
+		/// nothing decoded yet: don't copy the recycled encoded payload
+		free(pcmBuffer_);
+		pcmBuffer_ = (char*)malloc(pcmCapacity_);
+	}
+	else
+		pcmBuffer_ = (char*)realloc(pcmBuffer_, pcmCapacity_);
+}
+
+
 SampleFormat OggDecoder::setHeader(msg::CodecHeader* chunk)
 {
 	int size = chunk->payloadSize;
@@ -36,6 +36,7 @@ public:
 
 private:
 	bool decodePayload(msg::PcmChunk* chunk);
+	void reservePcm(size_t size);
 	template <typename T>
 	T clip(const T& value, const T& lower, const T& upper) const
 	{
@@ -55,6 +56,14 @@ private:
 	vorbis_block     vb; /// local working space for packet->PCM decode
 
 	SampleFormat sampleFormat_;
+
+	ogg_int64_t lastGranulepos_; /// granule position of the last page, -1 if unknown
+
+	/// decoded PCM of the current chunk, swapped into the chunk when done
+	char* pcmBuffer_;
+	size_t pcmCapacity_;
+	size_t pcmSize_;
+	size_t lastPcmSize_; /// PCM size of the last chunk
 };
 
 
@@ -20,6 +20,8 @@
 #define DOUBLE_BUFFER_H
 
 #include<deque>
+#include<set>
+#include<iterator>
 #include<algorithm>
 
 
@@ -27,20 +29,32 @@
 /**
  * Size limited queue with basic statistic functions:
  * median, mean, percentile
+ * Besides the queue, the values are kept sorted in a multiset with an iterator to the median,
+ * which is moved along on every add. add is O(log n), median and mean are O(1),
+ * percentile walks from the closest of begin, median and end.
  */
 template <class T>
 class DoubleBuffer
 {
 public:
-	DoubleBuffer(size_t size = 10) : bufferSize(size)
+	DoubleBuffer(size_t size = 10) : bufferSize(size), mid(sorted.end()), midIdx(0), sum(0.)
 	{
 	}
 
+	DoubleBuffer(const DoubleBuffer&) = delete;
+	DoubleBuffer& operator=(const DoubleBuffer&) = delete;
+
 	inline void add(const T& element)
 	{
 		buffer.push_back(element);
+		insert(element);
+		sum += element;
 		if (buffer.size() > bufferSize)
+		{
+			erase(buffer.front());
+			sum -= buffer.front();
 			buffer.pop_front();
+		}
 	}
 
 	/// Median as mean over N values around the median
@@ -48,20 +62,15 @@ public:
 	{
 		if (buffer.empty())
 			return 0;
-		std::deque<T> tmpBuffer(buffer.begin(), buffer.end());
-		std::sort(tmpBuffer.begin(), tmpBuffer.end());
-		if ((mean <= 1) || (tmpBuffer.size() < mean))
-			return tmpBuffer[tmpBuffer.size() / 2];
+		if ((mean <= 1) || (sorted.size() < mean))
+			return *mid;
 		else
 		{
-			unsigned int low = tmpBuffer.size() / 2;
-			unsigned int high = low;
-			low -= mean/2;
-			high += mean/2;
+			auto iter = std::prev(mid, mean/2);
 			T result((T)0);
-			for (unsigned int i=low; i<=high; ++i)
+			for (unsigned int i=0; i<=(mean/2)*2; ++i, ++iter)
 			{
-				result += tmpBuffer[i];
+				result += *iter;
 			}
 			return result / mean;
 		}
@@ -71,19 +80,23 @@ public:
 	{
 		if (buffer.empty())
 			return 0;
-		double mean = 0.;
-		for (size_t n=0; n<buffer.size(); ++n)
-			mean += (float)buffer[n] / (float)buffer.size();
-		return mean;
+		return sum / buffer.size();
 	}
 
 	T percentile(unsigned int percentile) const
 	{
 		if (buffer.empty())
 			return 0;
-		std::deque<T> tmpBuffer(buffer.begin(), buffer.end());
-		std::sort(tmpBuffer.begin(), tmpBuffer.end());
-		return tmpBuffer[(size_t)(tmpBuffer.size() * ((float)percentile / (float)100))];
+		size_t idx = (size_t)(sorted.size() * ((float)percentile / (float)100));
+		if (idx >= sorted.size())
+			idx = sorted.size() - 1;
+		if (idx < midIdx / 2)
+			return *std::next(sorted.begin(), idx);
+		else if (idx < midIdx)
+			return *std::prev(mid, midIdx - idx);
+		else if (idx < midIdx + (sorted.size() - midIdx) / 2)
+			return *std::next(mid, idx - midIdx);
+		return *std::prev(sorted.end(), sorted.size() - idx);
 	}
 
 	inline bool full() const
@@ -94,6 +107,10 @@ public:
 	inline void clear()
 	{
 		buffer.clear();
+		sorted.clear();
+		mid = sorted.end();
+		midIdx = 0;
+		sum = 0.;
 	}
 
 	inline size_t size() const
@@ -113,13 +130,66 @@ public:
 
 	const std::deque<T>& getBuffer() const
 	{
-		return &buffer;
+		return buffer;
 	}
 
 private:
+	void insert(const T& element)
+	{
+		if (sorted.empty())
+		{
+			mid = sorted.insert(element);
+			midIdx = 0;
+			return;
+		}
+		/// equal elements are inserted behind the median
+		if (element < *mid)
+			++midIdx;
+		sorted.insert(element);
+		rebalance();
+	}
+
+	void erase(const T& element)
+	{
+		if (!(element < *mid) && !(*mid < element))
+			mid = sorted.erase(mid);
+		else
+		{
+			if (element < *mid)
+				--midIdx;
+			sorted.erase(sorted.find(element));
+		}
+		if (sorted.empty())
+		{
+			mid = sorted.end();
+			midIdx = 0;
+			return;
+		}
+		rebalance();
+	}
+
+	/// move the median iterator to index size/2
+	void rebalance()
+	{
+		size_t target = sorted.size() / 2;
+		while (midIdx < target)
+		{
+			++mid;
+			++midIdx;
+		}
+		while (midIdx > target)
+		{
+			--mid;
+			--midIdx;
+		}
+	}
+
 	size_t bufferSize;
 	std::deque<T> buffer;
-
+	std::multiset<T> sorted;
+	typename std::multiset<T>::iterator mid;
+	size_t midIdx;
+	double sum;
 };
 
 
@@ -0,0 +1,172 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "pcmRing.h"
+
+using namespace std;
+namespace cs = chronos;
+
+static const size_t segmentCount = 1024;
+
+
+PcmRing::PcmRing(const SampleFormat& format, size_t ms) : format_(format), nextTime_(0), readPos_(0), segHead_(0), writePos_(0), segTail_(0)
+{
+	uint64_t frames = (uint64_t)format_.rate * ms / 1000;
+	uint64_t size = 1;
+	while (size < frames)
+		size <<= 1;
+	buffer_.resize(size * format_.frameSize);
+	mask_ = size - 1;
+	segments_.resize(segmentCount);
+	segMask_ = segmentCount - 1;
+}
+
+
+bool PcmRing::write(const msg::PcmChunk& chunk)
+{
+	uint64_t frames = chunk.getFrameCount();
+	if (frames == 0)
+		return true;
+
+	uint64_t writePos = writePos_.load(std::memory_order_relaxed);
+	if (writePos + frames - readPos_.load(std::memory_order_acquire) > mask_ + 1)
+		return false;
+
+	double chunkTime = chunk.timestamp.nsec / 1000.;
+	uint64_t segTail = segTail_.load(std::memory_order_relaxed);
+	/// a chunk that starts within one frame of the expected time continues the current segment
+	bool newSegment = (segTail == 0) || (fabs(chunkTime - nextTime_) >= 1000000. / format_.rate);
+	if (newSegment)
+	{
+		if (segTail - segHead_.load(std::memory_order_acquire) > segMask_)
+			return false;
+		segments_[segTail & segMask_] = {writePos, (cs::usec::rep)llround(chunkTime)};
+		nextTime_ = chunkTime;
+	}
+
+	size_t idx = writePos & mask_;
+	size_t first = min(frames, mask_ + 1 - idx);
+	memcpy(&buffer_[idx * format_.frameSize], chunk.payload, first * format_.frameSize);
+	if (first < frames)
+		memcpy(&buffer_[0], chunk.payload + first * format_.frameSize, (frames - first) * format_.frameSize);
+	nextTime_ += frames * 1000000. / format_.rate;
+
+	if (newSegment)
+		segTail_.store(segTail + 1, std::memory_order_release);
+	writePos_.store(writePos + frames, std::memory_order_release);
+	return true;
+}
+
+
+size_t PcmRing::available() const
+{
+	/// load the read position first, so that the difference can't become negative
+	uint64_t readPos = readPos_.load(std::memory_order_acquire);
+	return writePos_.load(std::memory_order_acquire) - readPos;
+}
+
+
+cs::usec PcmRing::duration() const
+{
+	return cs::usec((cs::usec::rep)(available() / format_.usRate()));
+}
+
+
+void PcmRing::advanceSegment(uint64_t readPos)
+{
+	uint64_t segHead = segHead_.load(std::memory_order_relaxed);
+	uint64_t segTail = segTail_.load(std::memory_order_acquire);
+	while ((segHead + 1 < segTail) && (segments_[(segHead + 1) & segMask_].pos <= readPos))
+		++segHead;
+	segHead_.store(segHead, std::memory_order_release);
+}
+
+
+cs::time_point_clk PcmRing::readTime()
+{
+	uint64_t readPos = readPos_.load(std::memory_order_relaxed);
+	advanceSegment(readPos);
+	const Segment& segment = segments_[segHead_.load(std::memory_order_relaxed) & segMask_];
+	return cs::time_point_clk(cs::usec(segment.time + (cs::usec::rep)llround((readPos - segment.pos) / format_.usRate())));
+}
+
+
+size_t PcmRing::span(const char*& data, size_t offset, size_t frames) const
+{
+	size_t idx = (readPos_.load(std::memory_order_relaxed) + offset) & mask_;
+	data = &buffer_[idx * format_.frameSize];
+	return min(frames, (size_t)(mask_ + 1 - idx));
+}
+
+
+size_t PcmRing::read(void* outputBuffer, size_t frames)
+{
+	frames = min(frames, available());
+	char* buffer = (char*)outputBuffer;
+	size_t read = 0;
+	while (read < frames)
+	{
+		const char* data;
+		size_t count = span(data, read, frames - read);
+		memcpy(buffer + read * format_.frameSize, data, count * format_.frameSize);
+		read += count;
+	}
+	consume(frames);
+	return frames;
+}
+
+
+void PcmRing::consume(size_t frames)
+{
+	uint64_t readPos = readPos_.load(std::memory_order_relaxed) + min(frames, available());
+	readPos_.store(readPos, std::memory_order_release);
+	advanceSegment(readPos);
+}
+
+
+bool PcmRing::seek(const cs::time_point_clk& timePoint)
+{
+	while (true)
+	{
+		size_t frames = available();
+		if (frames == 0)
+			return false;
+
+		cs::time_point_clk readTime = this->readTime();
+		if (readTime >= timePoint)
+			return true;
+
+		/// don't skip beyond the current segment, the next one might start at a different time
+		uint64_t readPos = readPos_.load(std::memory_order_relaxed);
+		uint64_t segHead = segHead_.load(std::memory_order_relaxed);
+		if (segHead + 1 < segTail_.load(std::memory_order_acquire))
+			frames = min(frames, (size_t)(segments_[(segHead + 1) & segMask_].pos - readPos));
+		double behind = ceil(std::chrono::duration_cast<cs::nsec>(timePoint - readTime).count() * format_.nsRate());
+		consume(min(frames, (size_t)behind));
+	}
+}
+
+
+void PcmRing::clear()
+{
+	consume(available());
+}
+
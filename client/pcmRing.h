@@ -0,0 +1,100 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef PCM_RING_H
+#define PCM_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "message/pcmChunk.h"
+#include "common/sampleFormat.h"
+#include "common/timeDefs.h"
+
+
+/// Lock-free, timestamp indexed ring of PCM frames
+/**
+ * Written by exactly one producer (the decoder) and read by exactly one consumer (the player).
+ * Frames of consecutive chunks are stored back to back. A second, small ring holds "segments":
+ * the ring position and server time of every chunk that does not seamlessly continue its predecessor.
+ * The time of any buffered frame is derived from its segment, so seeking by time is O(1) for
+ * a continuous stream, and the buffered duration is a plain difference of two positions.
+ * Producer: write
+ * Consumer: everything else, except available/duration, which can be called from any thread
+ */
+class PcmRing
+{
+public:
+	PcmRing(const SampleFormat& format, size_t ms);
+
+	/// Appends the chunk's frames. Returns false (and stores nothing) if there is not enough space
+	bool write(const msg::PcmChunk& chunk);
+
+	/// Number of buffered frames
+	size_t available() const;
+
+	/// Buffered duration
+	chronos::usec duration() const;
+
+	/// Server time of the next frame to be read. Only valid if frames are available
+	chronos::time_point_clk readTime();
+
+	/// Contiguous frames starting "offset" frames after the read position
+	/// Sets "data" to the first frame and returns the number of frames (<= frames) until the ring wraps
+	size_t span(const char*& data, size_t offset, size_t frames) const;
+
+	/// Copies up to "frames" frames into "outputBuffer", returns the number of frames read
+	size_t read(void* outputBuffer, size_t frames);
+
+	/// Drops "frames" frames (at most all available frames)
+	void consume(size_t frames);
+
+	/// Drops all frames older than "timePoint". Returns false if the ring ran empty
+	bool seek(const chronos::time_point_clk& timePoint);
+
+	/// Drops all buffered frames
+	void clear();
+
+private:
+	struct Segment
+	{
+		uint64_t pos;
+		chronos::usec::rep time;
+	};
+
+	/// Makes segHead_ the segment containing the read position
+	void advanceSegment(uint64_t readPos);
+
+	SampleFormat format_;
+	std::vector<char> buffer_;
+	uint64_t mask_;
+	std::vector<Segment> segments_;
+	uint64_t segMask_;
+
+	/// producer only: expected server time [us] of the next written frame
+	double nextTime_;
+
+	/// consumer and producer positions on separate cache lines
+	alignas(64) std::atomic<uint64_t> readPos_;
+	std::atomic<uint64_t> segHead_;
+	alignas(64) std::atomic<uint64_t> writePos_;
+	std::atomic<uint64_t> segTail_;
+};
+
+
+#endif
@@ -26,8 +26,8 @@
 
 using namespace std;
 
-AlsaPlayer::AlsaPlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream) : 
-	Player(pcmDevice, stream), handle_(NULL), buff_(NULL)
+AlsaPlayer::AlsaPlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream, const PlayerSettings& settings) : 
+	Player(pcmDevice, stream), settings_(settings), handle_(NULL), bufferFrames_(0), buff_(NULL), delay_(0)
 {
 }
 
@@ -59,8 +59,9 @@ void AlsaPlayer::initAlsa()
 		throw SnapException("Can't fill params: " + string(snd_strerror(pcm)));
 
 	/* Set parameters */
-	if ((pcm = snd_pcm_hw_params_set_access(handle_, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
-		throw SnapException("Can't set interleaved mode: " + string(snd_strerror(pcm)));
+	snd_pcm_access_t access = settings_.mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED;
+	if ((pcm = snd_pcm_hw_params_set_access(handle_, params, access)) < 0)
+		throw SnapException(string("Can't set ") + (settings_.mmap ? "mmap " : "") + "interleaved mode: " + string(snd_strerror(pcm)));
 
 	snd_pcm_format_t snd_pcm_format;
 	if (format.bits == 8)
@@ -138,10 +139,15 @@ void AlsaPlayer::initAlsa()
 
 	/* Allocate buffer to hold single period */
 	snd_pcm_hw_params_get_period_size(params, &frames_, 0);
-	logO << "frames: " << frames_ << "\n";
+	snd_pcm_hw_params_get_buffer_size(params, &bufferFrames_);
+	logO << "frames: " << frames_ << ", mmap: " << settings_.mmap << "\n";
 
-	buff_size = frames_ * format.frameSize; //channels * 2 /* 2 -> sample size */;
-	buff_ = (char *) malloc(buff_size);
+	/// in mmap mode the chunks are rendered directly into the DMA area
+	if (!settings_.mmap)
+	{
+		buff_size = frames_ * format.frameSize; //channels * 2 /* 2 -> sample size */;
+		buff_ = (char *) malloc(buff_size);
+	}
 
 	snd_pcm_hw_params_get_period_time(params, &tmp, NULL);
 	logD << "period time: " << tmp << "\n";
@@ -152,6 +158,9 @@ void AlsaPlayer::initAlsa()
 
 	snd_pcm_sw_params_set_avail_min(handle_, swparams, frames_);
 	snd_pcm_sw_params_set_start_threshold(handle_, swparams, frames_);
+	/// timestamp the status reports with the monotonic clock, to compare them against chronos::clk
+	snd_pcm_sw_params_set_tstamp_mode(handle_, swparams, SND_PCM_TSTAMP_ENABLE);
+	snd_pcm_sw_params_set_tstamp_type(handle_, swparams, SND_PCM_TSTAMP_TYPE_MONOTONIC);
 //	snd_pcm_sw_params_set_stop_threshold(pcm_handle, swparams, frames_);
 	snd_pcm_sw_params(handle_, swparams);
 }
@@ -194,10 +203,158 @@ void AlsaPlayer::stop()
 }
 
 
-void AlsaPlayer::worker()
+void AlsaPlayer::updateDelay()
 {
+	snd_pcm_status_t* status;
+	snd_pcm_status_alloca(&status);
+	double msRate = stream_->getFormat().msRate();
+	delayStamp_ = chronos::time_point_clk();
+	int err;
+	if ((err = snd_pcm_status(handle_, status)) < 0)
+	{
+		snd_pcm_sframes_t framesDelay;
+		snd_pcm_delay(handle_, &framesDelay);
+		delay_ = chronos::usec((chronos::usec::rep) (1000 * (double) framesDelay / msRate));
+		return;
+	}
+
+	/// The delay is sampled with the hw pointer update at "htstamp",
+	/// while running the DAC goes on playing from there
+	delay_ = chronos::usec((chronos::usec::rep) (1000 * (double) snd_pcm_status_get_delay(status) / msRate));
+	snd_htimestamp_t htstamp;
+	snd_pcm_status_get_htstamp(status, &htstamp);
+	if ((snd_pcm_status_get_state(status) == SND_PCM_STATE_RUNNING) && ((htstamp.tv_sec != 0) || (htstamp.tv_nsec != 0)))
+		delayStamp_ = chronos::time_point_clk(std::chrono::duration_cast<chronos::clk::duration>(std::chrono::seconds(htstamp.tv_sec) + std::chrono::nanoseconds(htstamp.tv_nsec)));
+//	logO << "delay[ms]: " << delay_.count() / 1000. << "\n";
+}
+
+
+chronos::usec AlsaPlayer::getDelay() const
+{
+	if (delayStamp_ == chronos::time_point_clk())
+		return delay_;
+
+	chronos::usec age = std::chrono::duration_cast<chronos::usec>(chronos::clk::now() - delayStamp_);
+	/// ignore implausible timestamps (i.e. not from the monotonic clock)
+	if ((age.count() < 0) || (age > delay_))
+		return delay_;
+	return delay_ - age;
+}
+
+
+void AlsaPlayer::recover(int err)
+{
+	if (err == -EPIPE)
+	{
+		logE << "XRUN\n";
+		++xruns_;
+		snd_pcm_prepare(handle_);
+	}
+	else if ((err = snd_pcm_recover(handle_, err, 1)) < 0)
+	{
+		logE << "ERROR. Can't write to PCM device: " << snd_strerror(err) << "\n";
+		uninitAlsa();
+	}
+}
+
+
+bool AlsaPlayer::writeRw()
+{
+	updateDelay();
+	if (!stream_->getPlayerChunk(buff_, getDelay(), frames_))
+		return false;
+
+	adjustVolume(buff_, frames_);
 	snd_pcm_sframes_t pcm;
-	snd_pcm_sframes_t framesDelay;
+	if ((pcm = snd_pcm_writei(handle_, buff_, frames_)) == -EPIPE)
+	{
+		logE << "XRUN\n";
+		++xruns_;
+		snd_pcm_prepare(handle_);
+	}
+	else if (pcm < 0)
+	{
+		logE << "ERROR. Can't write to PCM device: " << snd_strerror(pcm) << "\n";
+		uninitAlsa();
+	}
+	return true;
+}
+
+
+bool AlsaPlayer::writeMmap()
+{
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(handle_);
+	if (avail < 0)
+	{
+		recover(avail);
+		return true;
+	}
+
+	if ((snd_pcm_uframes_t)avail < frames_)
+	{
+		startMmap();
+		int err = snd_pcm_wait(handle_, 100);
+		if (err < 0)
+			recover(err);
+		return true;
+	}
+
+	/// one period, the DMA area may wrap around and return it in two parts
+	updateDelay();
+	const SampleFormat& format = stream_->getFormat();
+	snd_pcm_uframes_t written = 0;
+	while (written < frames_)
+	{
+		const snd_pcm_channel_area_t* areas;
+		snd_pcm_uframes_t offset;
+		snd_pcm_uframes_t frames = frames_ - written;
+		int err;
+		if ((err = snd_pcm_mmap_begin(handle_, &areas, &offset, &frames)) < 0)
+		{
+			recover(err);
+			return true;
+		}
+
+		char* buffer = (char*)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+		chronos::usec writtenDuration((chronos::usec::rep) (1000 * (double) written / format.msRate()));
+		if (!stream_->getPlayerChunk(buffer, getDelay() + writtenDuration, frames))
+		{
+			snd_pcm_mmap_commit(handle_, offset, 0);
+			return false;
+		}
+		adjustVolume(buffer, frames);
+
+		snd_pcm_sframes_t committed = snd_pcm_mmap_commit(handle_, offset, frames);
+		if ((committed < 0) || ((snd_pcm_uframes_t)committed != frames))
+		{
+			recover(committed < 0 ? committed : -EPIPE);
+			return true;
+		}
+		written += frames;
+	}
+	startMmap();
+	return true;
+}
+
+
+void AlsaPlayer::startMmap()
+{
+	/// snd_pcm_writei starts the PCM at the start threshold, snd_pcm_mmap_commit does not
+	if (snd_pcm_state(handle_) != SND_PCM_STATE_PREPARED)
+		return;
+
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(handle_);
+	if ((avail < 0) || (bufferFrames_ - (snd_pcm_uframes_t)avail < frames_))
+		return;
+
+	int err;
+	if ((err = snd_pcm_start(handle_)) < 0)
+		recover(err);
+}
+
+
+void AlsaPlayer::worker()
+{
 	long lastChunkTick = chronos::getTickCount();
 
 	while (active_)
@@ -212,28 +369,13 @@ void AlsaPlayer::worker()
 			{
 				logE << "Exception in initAlsa: " << e.what() << endl;
 				chronos::sleep(100);
+				continue;
 			}
 		}
 
-//		snd_pcm_avail_delay(handle_, &framesAvail, &framesDelay);
-		snd_pcm_delay(handle_, &framesDelay);
-		chronos::usec delay((chronos::usec::rep) (1000 * (double) framesDelay / stream_->getFormat().msRate()));
-//		logO << "delay: " << framesDelay << ", delay[ms]: " << delay.count() / 1000 << "\n";
-
-		if (stream_->getPlayerChunk(buff_, delay, frames_))
+		if (settings_.mmap ? writeMmap() : writeRw())
 		{
 			lastChunkTick = chronos::getTickCount();
-			adjustVolume(buff_, frames_);
-			if ((pcm = snd_pcm_writei(handle_, buff_, frames_)) == -EPIPE)
-			{
-				logE << "XRUN\n";
-				snd_pcm_prepare(handle_);
-			}
-			else if (pcm < 0)
-			{
-				logE << "ERROR. Can't write to PCM device: " << snd_strerror(pcm) << "\n";
-				uninitAlsa();
-			}
 		}
 		else
 		{
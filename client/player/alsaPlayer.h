@@ -20,17 +20,21 @@
 #define ALSA_PLAYER_H
 
 #include "player.h"
+#include "playerSettings.h"
 #include <alsa/asoundlib.h>
 
 
 /// Audio Player
 /**
  * Audio player implementation using Alsa
+ * With PlayerSettings::mmap the PCM data and volume are rendered directly
+ * into the device's DMA area (snd_pcm_mmap_begin/commit), saving a copy.
+ * Works with any ALSA PCM that supports mmap access, e.g. "null" or a "file" plugin
  */
 class AlsaPlayer : public Player
 {
 public:
-	AlsaPlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream);
+	AlsaPlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream, const PlayerSettings& settings = PlayerSettings());
 	virtual ~AlsaPlayer();
 
 	/// Set audio volume in range [0..1]
@@ -46,10 +50,26 @@ protected:
 private:
 	void initAlsa();
 	void uninitAlsa();
+	/// Samples the time until a frame written now will reach the DAC
+	void updateDelay();
+	/// The sampled delay, less the time the DAC has been playing since it was sampled
+	chronos::usec getDelay() const;
+	/// Play one period, return false if there was no chunk to play
+	bool writeRw();
+	bool writeMmap();
+	/// Starts the prepared PCM once a period (the start threshold) is buffered
+	void startMmap();
+	/// Recover from a failed ALSA call, closes the device if not possible
+	void recover(int err);
 
+	PlayerSettings settings_;
 	snd_pcm_t* handle_;
 	snd_pcm_uframes_t frames_;
+	snd_pcm_uframes_t bufferFrames_;
 	char *buff_;
+	chronos::usec delay_;
+	/// status htstamp of delay_, epoch if the PCM was not running
+	chronos::time_point_clk delayStamp_;
 };
 
 
@@ -0,0 +1,184 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <ctime>
+#include <cmath>
+
+#include "filePlayer.h"
+#include "common/log.h"
+#include "common/snapException.h"
+
+#define PERIOD_TIME 30000
+
+using namespace std;
+
+
+static long processCpuUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+FilePlayer::FilePlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream, const PlayerSettings& settings) :
+	Player(pcmDevice, stream),
+	settings_(settings),
+	running_(false),
+	writtenFrames_(0),
+	random_(std::random_device()()),
+	cpuStart_(0),
+	lastCpu_(0),
+	periods_(0),
+	sumError_(0),
+	maxError_(0)
+{
+	if (settings_.player.find("file:") == 0)
+		filename_ = settings_.player.substr(5);
+	else if (settings_.player != "null")
+		throw SnapException("Unknown player: \"" + settings_.player + "\"");
+
+	const SampleFormat& format = stream_->getFormat();
+	periodFrames_ = format.rate * (PERIOD_TIME / 1000) / 1000;
+	bufferFrames_ = 4 * periodFrames_;
+	dacRate_ = format.rate * (1. + settings_.rateOffset / 1000000.);
+	buffer_.resize(periodFrames_ * format.frameSize);
+}
+
+
+FilePlayer::~FilePlayer()
+{
+	stop();
+}
+
+
+void FilePlayer::start()
+{
+	if (!filename_.empty())
+	{
+		pcmFile_.open(filename_.c_str(), std::ofstream::out|std::ofstream::binary|std::ofstream::trunc);
+		if (!pcmFile_.is_open())
+			throw SnapException("Can't open " + filename_);
+		telemetryFile_.open((filename_ + ".csv").c_str(), std::ofstream::out|std::ofstream::trunc);
+		telemetryFile_ << "# time [ms], reported delay [us], DAC delay [us], sync error [us], process CPU [us]\n";
+	}
+	logO << "FilePlayer: " << (filename_.empty() ? "null" : filename_) << ", period: " << periodFrames_ << " frames, rate offset: "
+		<< settings_.rateOffset << " ppm, jitter: " << settings_.jitter << " us\n";
+	Player::start();
+}
+
+
+void FilePlayer::stop()
+{
+	Player::stop();
+	if (periods_ > 0)
+	{
+		double wall = std::chrono::duration<double, std::micro>(chronos::clk::now() - playStart_).count();
+		logO << "FilePlayer: periods: " << periods_ << ", mean |sync error|: " << sumError_ / periods_ << " us, max: " << maxError_
+			<< " us, CPU: " << 100. * (processCpuUs() - cpuStart_) / wall << "%\n";
+		periods_ = 0;
+	}
+	if (pcmFile_.is_open())
+		pcmFile_.close();
+	if (telemetryFile_.is_open())
+		telemetryFile_.close();
+}
+
+
+double FilePlayer::queuedFrames(const chronos::time_point_clk& now)
+{
+	if (!running_)
+		return 0;
+
+	double played = std::chrono::duration<double>(now - dacStart_).count() * dacRate_;
+	if (played >= writtenFrames_)
+	{
+		logO << "FilePlayer: underrun\n";
+		running_ = false;
+		writtenFrames_ = 0;
+		return 0;
+	}
+	return writtenFrames_ - played;
+}
+
+
+void FilePlayer::writeTelemetry(const chronos::usec& reported, const chronos::usec& delay, const chronos::usec& error)
+{
+	++periods_;
+	sumError_ += std::abs(error.count());
+	maxError_ = std::max(maxError_, (long)std::abs(error.count()));
+
+	long cpu = processCpuUs();
+	if (telemetryFile_.is_open())
+	{
+		telemetryFile_ << std::chrono::duration_cast<chronos::msec>(chronos::clk::now() - playStart_).count() << ", " << reported.count() << ", "
+			<< delay.count() << ", " << error.count() << ", " << cpu - lastCpu_ << "\n";
+	}
+	lastCpu_ = cpu;
+}
+
+
+void FilePlayer::worker()
+{
+	std::uniform_real_distribution<double> jitter(-(double)settings_.jitter, (double)settings_.jitter);
+	playStart_ = chronos::clk::now();
+	cpuStart_ = lastCpu_ = processCpuUs();
+
+	while (active_)
+	{
+		chronos::time_point_clk now = chronos::clk::now();
+		double queued = queuedFrames(now);
+
+		/// wait for a free period, like a sound card with avail_min = period
+		double freeFrames = bufferFrames_ - queued;
+		if (freeFrames < periodFrames_)
+		{
+			chronos::usleep((periodFrames_ - freeFrames) / dacRate_ * 1000000 + 1);
+			continue;
+		}
+
+		chronos::usec delay((chronos::usec::rep)(queued / dacRate_ * 1000000));
+		chronos::usec reported = delay + chronos::usec((chronos::usec::rep)jitter(random_));
+		if (reported.count() < 0)
+			reported = chronos::usec(0);
+
+		if (stream_->getPlayerChunk(buffer_.data(), reported, periodFrames_))
+		{
+			adjustVolume(buffer_.data(), periodFrames_);
+			/// the DAC starts with the first period (start threshold)
+			if (!running_)
+			{
+				running_ = true;
+				dacStart_ = now;
+			}
+			writtenFrames_ += periodFrames_;
+			if (pcmFile_.is_open())
+				pcmFile_.write(buffer_.data(), buffer_.size());
+			writeTelemetry(reported, delay, stream_->getLastAge() + (delay - reported));
+		}
+		else
+		{
+			logO << "Failed to get chunk\n";
+			running_ = false;
+			writtenFrames_ = 0;
+			while (active_ && !stream_->waitForChunk(100))
+				logD << "Waiting for chunk\n";
+		}
+	}
+}
+
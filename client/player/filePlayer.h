@@ -0,0 +1,80 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef FILE_PLAYER_H
+#define FILE_PLAYER_H
+
+#include <fstream>
+#include <random>
+#include "player.h"
+#include "playerSettings.h"
+
+
+/// Headless audio player
+/**
+ * Plays on a simulated DAC: a buffer of 4 periods that is drained by a clock
+ * running at the sample rate with a configurable deviation (PlayerSettings::rateOffset).
+ * The delay reported to the stream is disturbed by PlayerSettings::jitter.
+ * "null" discards the PCM data, "file:PATH" writes it to PATH and per period
+ * telemetry to PATH.csv:
+ *   time [ms], reported delay [us], DAC delay [us], sync error [us], process CPU [us]
+ * The sync error is the deviation of the period's first frame from its due time,
+ * based on the real (simulated) DAC delay
+ */
+class FilePlayer : public Player
+{
+public:
+	FilePlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream, const PlayerSettings& settings);
+	virtual ~FilePlayer();
+
+	virtual void start();
+	virtual void stop();
+
+protected:
+	virtual void worker();
+
+private:
+	/// Frames queued in the simulated DAC, resets the DAC on underrun
+	double queuedFrames(const chronos::time_point_clk& now);
+	void writeTelemetry(const chronos::usec& reported, const chronos::usec& delay, const chronos::usec& error);
+
+	PlayerSettings settings_;
+	std::string filename_;
+	std::ofstream pcmFile_;
+	std::ofstream telemetryFile_;
+	std::vector<char> buffer_;
+	size_t periodFrames_;
+	size_t bufferFrames_;
+	/// frames per second of the simulated DAC clock
+	double dacRate_;
+	bool running_;
+	chronos::time_point_clk dacStart_;
+	double writtenFrames_;
+	std::mt19937 random_;
+	chronos::time_point_clk playStart_;
+	/// process CPU time [us]
+	long cpuStart_;
+	long lastCpu_;
+
+	size_t periods_;
+	double sumError_;
+	long maxError_;
+};
+
+
+#endif
@@ -32,7 +32,9 @@ Player::Player(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream) :
 	pcmDevice_(pcmDevice),
 	volume_(1.0),
 	muted_(false),
-	volCorrection_(1.0)
+	volCorrection_(1.0),
+	gain_(-1.),
+	xruns_(0)
 {
 }
 
@@ -64,22 +66,27 @@ void Player::stop()
 
 void Player::adjustVolume(char* buffer, size_t frames)
 {
-	double volume = volume_;
-	if (muted_)
-		volume = 0.;
+	double target = muted_ ? 0. : volume_.load();
+	target *= volCorrection_;
+	double gain = (gain_ < 0.) ? target : gain_;
+	gain_ = target;
 
-	const SampleFormat& sampleFormat = stream_->getFormat();
+	/// unity and unchanged
+	if ((gain == 1.) && (target == 1.))
+		return;
 
-	if ((volume < 1.0) || (volCorrection_ != 1.))
-	{
-		volume *= volCorrection_;
-		if (sampleFormat.sampleSize == 1)
-			adjustVolume<int8_t>(buffer, frames*sampleFormat.channels, volume);
-		else if (sampleFormat.sampleSize == 2)
-			adjustVolume<int16_t>(buffer, frames*sampleFormat.channels, volume);
-		else if (sampleFormat.sampleSize == 4)
-			adjustVolume<int32_t>(buffer, frames*sampleFormat.channels, volume);
-	}
+	const SampleFormat& sampleFormat = stream_->getFormat();
+	if (frames == 0)
+		return;
+	double step = (target - gain) / frames;
+
+	/// float is exact enough for 8 and 16 bit, 32 bit samples need double
+	if (sampleFormat.sampleSize == 1)
+		applyGain<int8_t, float>(buffer, frames, sampleFormat.channels, gain, step);
+	else if (sampleFormat.sampleSize == 2)
+		applyGain<int16_t, float>(buffer, frames, sampleFormat.channels, gain, step);
+	else if (sampleFormat.sampleSize == 4)
+		applyGain<int32_t, double>(buffer, frames, sampleFormat.channels, gain, step);
 }
 
 
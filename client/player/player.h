@@ -23,6 +23,8 @@
 #include <thread>
 #include <atomic>
 #include <vector>
+#include <limits>
+#include <algorithm>
 #include "stream.h"
 #include "pcmDevice.h"
 #include "common/endian.h"
@@ -45,26 +47,61 @@ public:
 	virtual void start();
 	virtual void stop();
 
+	/// Number of buffer underruns of the audio output
+	uint32_t getXruns() const
+	{
+		return xruns_;
+	}
+
 protected:
 	virtual void worker() = 0;
 
-	template <typename T>
-	void adjustVolume(char *buffer, size_t count, double volume)
+	/// Scales "frames" frames by a gain that starts at "gain" and changes by "step" per frame,
+	/// all channels of a frame get the same gain.
+	/// Saturates to the sample type. Written to be auto-vectorized (F = float or double)
+	template <typename T, typename F>
+	void applyGain(char *buffer, size_t frames, size_t channels, F gain, F step)
 	{
 		T* bufferT = (T*)buffer;
-		for (size_t n=0; n<count; ++n)
-			bufferT[n] = endian::swap<T>(endian::swap<T>(bufferT[n]) * volume);
+		const F minValue = std::numeric_limits<T>::min();
+		const F maxValue = std::numeric_limits<T>::max();
+		if (step == 0)
+		{
+			size_t count = frames * channels;
+			for (size_t n=0; n<count; ++n)
+			{
+				F value = (F)endian::swap<T>(bufferT[n]) * gain;
+				bufferT[n] = endian::swap<T>((T)std::max(minValue, std::min(maxValue, value)));
+			}
+		}
+		else
+		{
+			for (size_t n=0; n<frames; ++n)
+			{
+				F frameGain = gain + (F)n * step;
+				T* frame = bufferT + n * channels;
+				for (size_t c=0; c<channels; ++c)
+				{
+					F value = (F)endian::swap<T>(frame[c]) * frameGain;
+					frame[c] = endian::swap<T>((T)std::max(minValue, std::min(maxValue, value)));
+				}
+			}
+		}
 	}
 
+	/// Applies volume, mute and volCorrection_. Gain changes are ramped linearly over the buffer
 	void adjustVolume(char* buffer, size_t frames);
 
 	std::atomic<bool> active_;
 	std::shared_ptr<Stream> stream_;
 	std::thread playerThread_;
 	PcmDevice pcmDevice_;
-	double volume_;
-	bool muted_;
+	std::atomic<double> volume_;
+	std::atomic<bool> muted_;
 	double volCorrection_;
+	/// gain applied at the end of the last buffer, < 0: none yet
+	double gain_;
+	std::atomic<uint32_t> xruns_;
 };
 
 
@@ -0,0 +1,41 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef PLAYER_SETTINGS_H
+#define PLAYER_SETTINGS_H
+
+#include <string>
+#include <cstddef>
+
+
+/// Audio backend options, passed from the command line to the player
+struct PlayerSettings
+{
+	PlayerSettings() : mmap(false), rateOffset(0.), jitter(0) {};
+	/// ALSA: render directly into the device's mmap area instead of using snd_pcm_writei
+	bool mmap;
+	/// Headless backend instead of the sound card: "null" or "file:PATH" (see FilePlayer)
+	std::string player;
+	/// Simulated DAC: clock deviation [ppm]
+	double rateOffset;
+	/// Simulated DAC: jitter of the reported delay [us]
+	size_t jitter;
+};
+
+
+#endif
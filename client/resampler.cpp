@@ -0,0 +1,193 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <cmath>
+#include <algorithm>
+#include "resampler.h"
+#include "common/endian.h"
+
+using namespace std;
+
+
+Resampler::Resampler(const SampleFormat& format) : format_(format), phase_(0.), hasHistory_(false)
+{
+	/// room for the history frame plus a typical player period
+	input_.reserve((4096 + 4) * format_.channels);
+	output_.reserve(4096 * format_.channels);
+	input_.resize(format_.channels);
+}
+
+
+void Resampler::reset()
+{
+	phase_ = 0.;
+	hasHistory_ = false;
+}
+
+
+size_t Resampler::framesNeeded(size_t frames, double ratio) const
+{
+	if (frames == 0)
+		return 0;
+	/// the last output frame interpolates between ring frames i and i+1, and needs i+2
+	size_t last = (size_t)floor(phase_ + (frames - 1) * ratio) + 3;
+	size_t consumed = (size_t)floor(phase_ + frames * ratio);
+	return max(last, consumed);
+}
+
+
+template<typename T>
+void Resampler::toFloat(const char* data, size_t samples, float* out) const
+{
+	const T* in = (const T*)data;
+	for (size_t n=0; n<samples; ++n)
+		out[n] = (float)endian::swap<T>(in[n]);
+}
+
+
+template<typename T>
+void Resampler::fromFloat(const float* in, size_t samples, char* data) const
+{
+	const double maxValue = (double)(((int64_t)1 << (format_.bits - 1)) - 1);
+	const double minValue = -maxValue - 1.;
+	T* out = (T*)data;
+	for (size_t n=0; n<samples; ++n)
+	{
+		double value = round(in[n]);
+		if (value > maxValue)
+			value = maxValue;
+		else if (value < minValue)
+			value = minValue;
+		out[n] = endian::swap<T>((T)value);
+	}
+}
+
+
+void Resampler::load(PcmRing& ring, size_t frames)
+{
+	const size_t channels = format_.channels;
+	if (input_.size() < (frames + 1) * channels)
+		input_.resize((frames + 1) * channels);
+
+	size_t offset = 0;
+	while (offset < frames)
+	{
+		const char* data;
+		size_t count = ring.span(data, offset, frames - offset);
+		float* out = &input_[(offset + 1) * channels];
+		if (format_.sampleSize == 1)
+			toFloat<int8_t>(data, count * channels, out);
+		else if (format_.sampleSize == 2)
+			toFloat<int16_t>(data, count * channels, out);
+		else
+			toFloat<int32_t>(data, count * channels, out);
+		offset += count;
+	}
+
+	if (!hasHistory_)
+		copy(&input_[channels], &input_[2 * channels], input_.begin());
+}
+
+
+void Resampler::store(size_t samples, char* data) const
+{
+	if (format_.sampleSize == 1)
+		fromFloat<int8_t>(output_.data(), samples, data);
+	else if (format_.sampleSize == 2)
+		fromFloat<int16_t>(output_.data(), samples, data);
+	else
+		fromFloat<int32_t>(output_.data(), samples, data);
+}
+
+
+bool Resampler::resample(PcmRing& ring, void* outputBuffer, size_t frames, double ratio)
+{
+	const size_t channels = format_.channels;
+
+	/// at the nominal rate the phase is rounded to a whole frame (less than 1/2 frame of sync error),
+	/// so that playback in sync is bit exact
+	if ((ratio == 1.) && (phase_ != 0.))
+	{
+		if (ring.available() < frames + 1)
+			return false;
+		if (phase_ >= 0.5)
+		{
+			load(ring, 1);
+			copy(&input_[channels], &input_[2 * channels], input_.begin());
+			ring.consume(1);
+		}
+		phase_ = 0.;
+	}
+
+	if ((ratio == 1.) && (phase_ == 0.))
+	{
+		if (ring.available() < frames)
+			return false;
+		ring.read(outputBuffer, frames);
+		/// remember the last frame as history for a later fractional read
+		if (frames > 0)
+		{
+			const char* last = (const char*)outputBuffer + (frames - 1) * format_.frameSize;
+			if (format_.sampleSize == 1)
+				toFloat<int8_t>(last, channels, &input_[0]);
+			else if (format_.sampleSize == 2)
+				toFloat<int16_t>(last, channels, &input_[0]);
+			else
+				toFloat<int32_t>(last, channels, &input_[0]);
+			hasHistory_ = true;
+		}
+		return true;
+	}
+
+	size_t needed = framesNeeded(frames, ratio);
+	if (ring.available() < needed)
+		return false;
+
+	load(ring, needed);
+	if (output_.size() < frames * channels)
+		output_.resize(frames * channels);
+
+	const float* input = input_.data();
+	float* output = output_.data();
+	for (size_t n=0; n<frames; ++n)
+	{
+		double pos = phase_ + n * ratio;
+		size_t idx = (size_t)pos;
+		float t = (float)(pos - idx);
+		const float* x = input + idx * channels;
+		for (size_t c=0; c<channels; ++c)
+		{
+			float xm1 = x[c];
+			float x0 = x[channels + c];
+			float x1 = x[2 * channels + c];
+			float x2 = x[3 * channels + c];
+			output[n * channels + c] = x0 + 0.5f * t * (x1 - xm1 + t * (2.f*xm1 - 5.f*x0 + 4.f*x1 - x2 + t * (3.f*(x0 - x1) + x2 - xm1)));
+		}
+	}
+	store(frames * channels, (char*)outputBuffer);
+
+	double end = phase_ + frames * ratio;
+	size_t consumed = (size_t)end;
+	phase_ = end - consumed;
+	/// the frame preceding the new read position becomes the history
+	copy(&input_[consumed * channels], &input_[(consumed + 1) * channels], input_.begin());
+	hasHistory_ = true;
+	ring.consume(consumed);
+	return true;
+}
+
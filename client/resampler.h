@@ -0,0 +1,74 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <vector>
+#include "pcmRing.h"
+#include "common/sampleFormat.h"
+
+
+/// Fractional rate converter for the playout sync
+/**
+ * Reads frames from a PcmRing at "ratio" input frames per output frame, using
+ * 4 point cubic Hermite (Catmull-Rom) interpolation.
+ * The fractional read position and the frame preceding the read position are kept
+ * across calls, so consecutive periods are seamless. Works on a persistent float buffer:
+ * no allocations once it has grown to the player's period size.
+ */
+class Resampler
+{
+public:
+	Resampler(const SampleFormat& format);
+
+	/// Writes "frames" frames to "outputBuffer". Returns false (and reads nothing) if the ring holds too few frames
+	bool resample(PcmRing& ring, void* outputBuffer, size_t frames, double ratio);
+
+	/// Number of ring frames that must be available to resample "frames" frames
+	size_t framesNeeded(size_t frames, double ratio) const;
+
+	/// Fractional read position in [0..1) frames, i.e. the output lags the ring's read time by this
+	double phase() const
+	{
+		return phase_;
+	}
+
+	/// Drops the history after a discontinuity (seek, clear, silence)
+	void reset();
+
+private:
+	template<typename T>
+	void toFloat(const char* data, size_t samples, float* out) const;
+
+	template<typename T>
+	void fromFloat(const float* in, size_t samples, char* data) const;
+
+	void load(PcmRing& ring, size_t frames);
+	void store(size_t samples, char* data) const;
+
+	SampleFormat format_;
+	double phase_;
+	bool hasHistory_;
+	/// interleaved input frames, starting with the frame preceding the ring's read position
+	std::vector<float> input_;
+	std::vector<float> output_;
+};
+
+
+#endif
@@ -108,6 +108,7 @@ int main (int argc, char **argv)
 		size_t port(1704);
 		int latency(0);
 		int processPriority(-3);
+		PlayerSettings playerSettings;
 
 		Switch helpSwitch("", "help", "produce help message");
 		Switch versionSwitch("v", "version", "show version number");
@@ -117,6 +118,10 @@ int main (int argc, char **argv)
 		Value<string> soundcardValue("s", "soundcard", "index or name of the soundcard", "default", &soundcard);
 		Implicit<int> daemonOption("d", "daemon", "daemonize, optional process priority [-20..19]", -3, &processPriority);
 		Value<int> latencyValue("", "latency", "latency of the soundcard", 0, &latency);
+		Switch mmapSwitch("", "mmap", "write directly into the soundcard's mmap buffer");
+		Value<string> playerValue("", "player", "headless player instead of the soundcard\n(null|file:PATH), PATH.csv: sync telemetry", "", &playerSettings.player);
+		Value<double> playerRateValue("", "playerRate", "clock deviation of the headless player [ppm]", 0., &playerSettings.rateOffset);
+		Value<size_t> playerJitterValue("", "playerJitter", "delay jitter of the headless player [us]", 0, &playerSettings.jitter);
 
 		OptionParser op("Allowed options");
 		op.add(helpSwitch)
@@ -126,10 +131,14 @@ int main (int argc, char **argv)
 #if defined(HAS_ALSA)
 		 .add(listSwitch)
 		 .add(soundcardValue)
+		 .add(mmapSwitch)
 #endif
 #ifdef HAS_DAEMON
 		 .add(daemonOption)
 #endif
+		 .add(playerValue)
+		 .add(playerRateValue)
+		 .add(playerJitterValue)
 		 .add(latencyValue);
 
 		try
@@ -207,9 +216,15 @@ int main (int argc, char **argv)
 		cli::startCLIServer();
 		// A.K. end
 
+		if (!playerSettings.player.empty() && (playerSettings.player != "null") && (playerSettings.player.find("file:") != 0))
+		{
+			cout << "unknown player \"" << playerSettings.player << "\"\n";
+			exit(EXIT_FAILURE);
+		}
+
 		PcmDevice pcmDevice = getPcmDevice(soundcard);
 #if defined(HAS_ALSA)
-		if (pcmDevice.idx == -1)
+		if ((pcmDevice.idx == -1) && playerSettings.player.empty())
 		{
 			cout << "soundcard \"" << soundcard << "\" not found\n";
 //			exit(EXIT_FAILURE);
@@ -242,11 +257,12 @@ int main (int argc, char **argv)
 #endif
 		}
 
+		playerSettings.mmap = mmapSwitch.isSet();
 		std::unique_ptr<Controller> controller(new Controller());
 		if (!g_terminated)
 		{
 			logO << "Latency: " << latency << "\n";
-			controller->start(pcmDevice, host, port, latency);
+			controller->start(pcmDevice, playerSettings, host, port, latency);
 			while(!g_terminated)
 				chronos::sleep(100);
 			controller->stop();
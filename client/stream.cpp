@@ -33,7 +33,7 @@ using namespace std;
 namespace cs = chronos;
 
 
-Stream::Stream(const SampleFormat& sampleFormat) : format_(sampleFormat), sleep_(0), median_(0), shortMedian_(0), lastUpdate_(0), playedFrames_(0), bufferMs_(cs::msec(500))
+Stream::Stream(const SampleFormat& sampleFormat) : format_(sampleFormat), sleep_(0), ring_(sampleFormat, 10000), resampler_(sampleFormat), median_(0), shortMedian_(0), lastUpdate_(0), rateRatio_(1.), bufferLen_(cs::msec(500)), targetBufferLen_(500000), bufferJump_(false), outputDelay_(0), lastAge_(0), resyncs_(0)
 {
 	buffer_.setSize(500);
 	shortBuffer_.setSize(100);
@@ -66,7 +66,7 @@ x = 1,000016667 / (1,000016667 - 1)
 			// waiting for stop signal
 			for (int i = 0; !stopping; i++)
 			{
-				context.getOutput() << "chunks in queue = " << chunks_.size() << cli::Messages::endOfLine;
+				context.getOutput() << "buffered ms = " << cs::duration<cs::msec>(ring_.duration()) << cli::Messages::endOfLine;
 				usleep(1000000);
 			}
 		}
@@ -77,52 +77,64 @@ x = 1,000016667 / (1,000016667 - 1)
 
 void Stream::setRealSampleRate(double sampleRate)
 {
-	if (sampleRate == format_.rate)
-		correctAfterXFrames_ = 0;
-	else
-		correctAfterXFrames_ = round((format_.rate / sampleRate) / (format_.rate / sampleRate - 1.));
-//	logD << "Correct after X: " << correctAfterXFrames_ << " (Real rate: " << sampleRate << ", rate: " << format_.rate << ")\n";
+	rateRatio_ = format_.rate / sampleRate;
+//	logD << "Rate ratio: " << rateRatio_ << " (Real rate: " << sampleRate << ", rate: " << format_.rate << ")\n";
 }
 
 
-void Stream::setBufferLen(size_t bufferLenMs)
+void Stream::setBufferLen(size_t bufferLenMs, bool smooth)
 {
-	bufferMs_ = cs::msec(bufferLenMs);
+	/// an unchanged buffer (e.g. volume change) doesn't cut short a running adjustment
+	cs::usec::rep bufferLen = cs::usec(cs::msec(bufferLenMs)).count();
+	if (targetBufferLen_.exchange(bufferLen) != bufferLen && !smooth)
+		bufferJump_ = true;
 }
 
 
 
 void Stream::clearChunks()
 {
-	while (chunks_.size() > 0)
-		chunks_.pop();
+	ring_.clear();
+	resampler_.reset();
 	resetBuffers();
 }
 
 
 void Stream::addChunk(msg::PcmChunk* chunk)
 {
-	while (chunks_.size() * chunk->duration<cs::msec>().count() > 10000)
-		chunks_.pop();
-	chunks_.push(shared_ptr<msg::PcmChunk>(chunk));
-//	logD << "new chunk: " << chunk->duration<cs::msec>().count() << ", Chunks: " << chunks_.size() << "\n";
+	/// the ring holds up to 10s. The player drops old frames, so a full ring means that nobody is playing
+	if (!ring_.write(*chunk))
+		logD << "PCM ring full, dropping chunk\n";
+	delete chunk;
+//	logD << "new chunk: " << chunk->duration<cs::msec>().count() << ", buffered: " << cs::duration<cs::msec>(ring_.duration()) << "\n";
 }
 
 
 bool Stream::waitForChunk(size_t ms) const
 {
-	return chunks_.wait_for(std::chrono::milliseconds(ms));
+	return waitForFrames(1, cs::msec(ms));
+}
+
+
+bool Stream::waitForFrames(size_t frames, const cs::usec& timeout) const
+{
+	cs::time_point_clk end = cs::clk::now() + timeout;
+	while (ring_.available() < frames)
+	{
+		if (cs::clk::now() >= end)
+			return false;
+		cs::sleep(1);
+	}
+	return true;
 }
 
 
 
 cs::time_point_clk Stream::getSilentPlayerChunk(void* outputBuffer, unsigned long framesPerBuffer)
 {
-	if (!chunk_)
-		chunk_ = chunks_.pop();
-	cs::time_point_clk tp = chunk_->start();
 	memset(outputBuffer, 0, framesPerBuffer * format_.frameSize);
-	return tp;
+	resampler_.reset();
+	return ring_.readTime();
 }
 
 
@@ -164,46 +176,15 @@ time_point_clk Stream::seek(long ms)
 */
 
 
-cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, const cs::usec& timeout, unsigned long framesPerBuffer)
+bool Stream::getNextPlayerChunk(void* outputBuffer, const cs::usec& timeout, unsigned long framesPerBuffer, double framesCorrection, cs::time_point_clk& start)
 {
-	if (!chunk_ && !chunks_.try_pop(chunk_, timeout))
-		throw 0;
-
-	cs::time_point_clk tp = chunk_->start();
-	char* buffer = (char*)outputBuffer;
-	unsigned long read = 0;
-	while (read < framesPerBuffer)
-	{
-		read += chunk_->readFrames(buffer + read*format_.frameSize, framesPerBuffer - read);
-		if (chunk_->isEndOfChunk() && !chunks_.try_pop(chunk_, timeout))
-			throw 0;
-	}
-	return tp;
-}
-
-
-cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, const cs::usec& timeout, unsigned long framesPerBuffer, long framesCorrection)
-{
-	if (framesCorrection == 0)
-		return getNextPlayerChunk(outputBuffer, timeout, framesPerBuffer);
-
-	long toRead = framesPerBuffer + framesCorrection;
-	char* buffer = (char*)malloc(toRead * format_.frameSize);
-	cs::time_point_clk tp = getNextPlayerChunk(buffer, timeout, toRead);
-
-	float factor = (float)toRead / framesPerBuffer;//(float)(framesPerBuffer*channels_);
-//	if (abs(framesCorrection) > 1)
-//		logO << "correction: " << framesCorrection << ", factor: " << factor << "\n";
-	float idx = 0;
-	for (size_t n=0; n<framesPerBuffer; ++n)
-	{
-		size_t index(floor(idx));// = (int)(ceil(n*factor));
-		memcpy((char*)outputBuffer + n*format_.frameSize, buffer + index*format_.frameSize, format_.frameSize);
-		idx += factor;
-	}
-	free(buffer);
+	double ratio = (framesPerBuffer + framesCorrection) / framesPerBuffer;
+	if (!waitForFrames(resampler_.framesNeeded(framesPerBuffer, ratio), timeout))
+		return false;
 
-	return tp;
+	/// the resampler reads from a fractional position, slightly after the ring's read position
+	start = ring_.readTime() + cs::usec((cs::usec::rep)(resampler_.phase() / format_.usRate()));
+	return resampler_.resample(ring_, outputBuffer, framesPerBuffer, ratio);
 }
 
 
@@ -227,28 +208,30 @@ void Stream::resetBuffers()
 
 bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacTime, unsigned long framesPerBuffer)
 {
-	if (outputBufferDacTime > bufferMs_)
+	outputDelay_ = outputBufferDacTime.count();
+	if (bufferJump_.exchange(false))
+		bufferLen_ = cs::usec(targetBufferLen_.load());
+
+	if (outputBufferDacTime > bufferLen_)
 	{
-		logO << "outputBufferDacTime > bufferMs: " << cs::duration<cs::msec>(outputBufferDacTime) << " > " << cs::duration<cs::msec>(bufferMs_) << "\n";
+		logO << "outputBufferDacTime > bufferMs: " << cs::duration<cs::msec>(outputBufferDacTime) << " > " << cs::duration<cs::msec>(bufferLen_) << "\n";
 		sleep_ = cs::usec(0);
 		return false;
 	}
 
-	if (!chunk_ && !chunks_.try_pop(chunk_, outputBufferDacTime))
+	if (!waitForFrames(1, outputBufferDacTime))
 	{
 		logO << "no chunks available\n";
 		sleep_ = cs::usec(0);
 		return false;
 	}
 
-	playedFrames_ += framesPerBuffer;
-
 	/// we have a chunk
 	/// age = chunk age (server now - rec time: some positive value) - buffer (e.g. 1000ms) + time to DAC
 	/// age = 0 => play now
 	/// age < 0 => play in -age
 	/// age > 0 => too old
-	cs::usec age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - chunk_->start()) - bufferMs_ + outputBufferDacTime;
+	cs::usec age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - ring_.readTime()) - bufferLen_ + outputBufferDacTime;
 //	logO << "age: " << age.count() / 1000 << "\n";
 	if ((sleep_.count() == 0) && (cs::abs(age) > cs::msec(200)))
 	{
@@ -256,151 +239,151 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
 		sleep_ = age;
 	}
 
-	try
-	{
-
 	//logD << "framesPerBuffer: " << framesPerBuffer << "\tms: " << framesPerBuffer*2 / PLAYER_CHUNK_MS_SIZE << "\t" << PLAYER_CHUNK_SIZE << "\n";
-		cs::nsec bufferDuration = cs::nsec(cs::nsec::rep(framesPerBuffer / format_.nsRate()));
-//		logD << "buffer duration: " << bufferDuration.count() << "\n";
+	cs::nsec bufferDuration = cs::nsec(cs::nsec::rep(framesPerBuffer / format_.nsRate()));
+//	logD << "buffer duration: " << bufferDuration.count() << "\n";
 
-		cs::usec correction = cs::usec(0);
-		if (sleep_.count() != 0)
+	cs::usec correction = cs::usec(0);
+	if (sleep_.count() != 0)
+	{
+		resetBuffers();
+		if (sleep_ < -bufferDuration/2)
 		{
-			resetBuffers();
+			logO << "sleep < -bufferDuration/2: " << cs::duration<cs::msec>(sleep_) << " < " << -cs::duration<cs::msec>(bufferDuration)/2 << ", ";
+			// We're early: not enough chunks. play silence. Reference is the oldest buffered frame
+			sleep_ = chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - getSilentPlayerChunk(outputBuffer, framesPerBuffer) - bufferLen_ + outputBufferDacTime);
+			logO << "sleep: " << cs::duration<cs::msec>(sleep_) << "\n";
 			if (sleep_ < -bufferDuration/2)
 			{
-				logO << "sleep < -bufferDuration/2: " << cs::duration<cs::msec>(sleep_) << " < " << -cs::duration<cs::msec>(bufferDuration)/2 << ", ";
-				// We're early: not enough chunks_. play silence. Reference chunk_ is the oldest (front) one
-				sleep_ = chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - getSilentPlayerChunk(outputBuffer, framesPerBuffer) - bufferMs_ + outputBufferDacTime);
-				logO << "sleep: " << cs::duration<cs::msec>(sleep_) << "\n";
-				if (sleep_ < -bufferDuration/2)
-					return true;
-			}
-			else if (sleep_ > bufferDuration/2)
-			{
-				logO << "sleep > bufferDuration/2: " << cs::duration<cs::msec>(sleep_) << " > " << cs::duration<cs::msec>(bufferDuration)/2 << "\n";
-				// We're late: discard oldest chunks
-				while (sleep_ > chunk_->duration<cs::usec>())
-				{
-					logO << "sleep > chunkDuration: " << cs::duration<cs::msec>(sleep_) << " > " << chunk_->duration<cs::msec>().count() << ", chunks: " << chunks_.size() << ", out: " << cs::duration<cs::msec>(outputBufferDacTime) << ", needed: " << cs::duration<cs::msec>(bufferDuration) << "\n";
-					sleep_ = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - chunk_->start() - bufferMs_ + outputBufferDacTime);
-					if (!chunks_.try_pop(chunk_, outputBufferDacTime))
-					{
-						logO << "no chunks available\n";
-						chunk_ = NULL;
-						sleep_ = cs::usec(0);
-						return false;
-					}
-				}
+				lastAge_ = sleep_.count();
+				return true;
 			}
-
-			// out of sync, can be corrected by playing faster/slower
-			if (sleep_ < -cs::usec(100))
-			{
-				sleep_ += cs::usec(100);
-				correction = -cs::usec(100);
-			}
-			else if (sleep_ > cs::usec(100))
-			{
-				sleep_ -= cs::usec(100);
-				correction = cs::usec(100);
-			}
-			else
+		}
+		else if (sleep_ > bufferDuration/2)
+		{
+			logO << "sleep > bufferDuration/2: " << cs::duration<cs::msec>(sleep_) << " > " << cs::duration<cs::msec>(bufferDuration)/2 << "\n";
+			// We're late: discard old frames, i.e. seek to the frame that is due now
+			logO << "seek: " << cs::duration<cs::msec>(sleep_) << ", buffered: " << cs::duration<cs::msec>(ring_.duration()) << ", out: " << cs::duration<cs::msec>(outputBufferDacTime) << ", needed: " << cs::duration<cs::msec>(bufferDuration) << "\n";
+			if (!ring_.seek(TimeProvider::serverNow() - bufferLen_ + outputBufferDacTime))
 			{
-				logO << "Sleep " << cs::duration<cs::msec>(sleep_) << "\n";
-				correction = sleep_;
+				logO << "no chunks available\n";
 				sleep_ = cs::usec(0);
+				return false;
 			}
+			resampler_.reset();
+			sleep_ = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - ring_.readTime() - bufferLen_ + outputBufferDacTime);
 		}
 
-		// framesCorrection = number of frames to be read more or less to get in-sync
-		long framesCorrection = correction.count()*format_.usRate();
-
-		// sample rate correction
-		if ((correctAfterXFrames_ != 0) && (playedFrames_ >= (unsigned long)abs(correctAfterXFrames_)))
+		// out of sync, can be corrected by playing faster/slower
+		if (sleep_ < -cs::usec(100))
+		{
+			sleep_ += cs::usec(100);
+			correction = -cs::usec(100);
+		}
+		else if (sleep_ > cs::usec(100))
+		{
+			sleep_ -= cs::usec(100);
+			correction = cs::usec(100);
+		}
+		else
 		{
-			framesCorrection += (correctAfterXFrames_ > 0)?1:-1;
-			playedFrames_ -= abs(correctAfterXFrames_);
+			logO << "Sleep " << cs::duration<cs::msec>(sleep_) << "\n";
+			correction = sleep_;
+			sleep_ = cs::usec(0);
 		}
+	}
 
-		age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - getNextPlayerChunk(outputBuffer, outputBufferDacTime, framesPerBuffer, framesCorrection) - bufferMs_ + outputBufferDacTime);
+	// framesCorrection = number of frames to be read more or less to get in-sync, including the sample rate correction
+	double framesCorrection = correction.count()*format_.usRate() + framesPerBuffer*(rateRatio_ - 1.);
 
-		setRealSampleRate(format_.rate);
-		if (sleep_.count() == 0)
+	// buffer change: move by at most 0.5% of the period and read that much less (more), so that the age doesn't change
+	cs::usec::rep bufferStep = targetBufferLen_.load() - bufferLen_.count();
+	if (bufferStep != 0)
+	{
+		cs::usec::rep maxStep = cs::usec::rep(framesPerBuffer / format_.usRate() * 0.005);
+		bufferStep = std::max(-maxStep, std::min(maxStep, bufferStep));
+		bufferLen_ += cs::usec(bufferStep);
+		framesCorrection -= bufferStep * format_.usRate();
+	}
+
+	cs::time_point_clk start;
+	if (!getNextPlayerChunk(outputBuffer, outputBufferDacTime, framesPerBuffer, framesCorrection, start))
+	{
+		sleep_ = cs::usec(0);
+		return false;
+	}
+	age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - start - bufferLen_ + outputBufferDacTime);
+	lastAge_ = age.count();
+
+	setRealSampleRate(format_.rate);
+	if (sleep_.count() == 0)
+	{
+		if (buffer_.full())
 		{
-			if (buffer_.full())
+			if (cs::usec(abs(median_)) > cs::msec(1))
 			{
-				if (cs::usec(abs(median_)) > cs::msec(1))
-				{
-					logO << "pBuffer->full() && (abs(median_) > 1): " << median_ << "\n";
-					sleep_ = cs::usec(median_);
-				}
-/*				else if (cs::usec(median_) > cs::usec(300))
-				{
-					setRealSampleRate(format_.rate - format_.rate / 1000);
-				}
-				else if (cs::usec(median_) < -cs::usec(300))
-				{
-					setRealSampleRate(format_.rate + format_.rate / 1000);
-				}
-*/			}
-			else if (shortBuffer_.full())
+				logO << "pBuffer->full() && (abs(median_) > 1): " << median_ << "\n";
+				sleep_ = cs::usec(median_);
+			}
+/*			else if (cs::usec(median_) > cs::usec(300))
 			{
-				if (cs::usec(abs(shortMedian_)) > cs::msec(5))
-				{
-					logO << "pShortBuffer->full() && (abs(shortMedian_) > 5): " << shortMedian_ << "\n";
-					sleep_ = cs::usec(shortMedian_);
-				}
-/*				else
-				{
-					setRealSampleRate(format_.rate + -shortMedian_ / 100);
-				}
-*/			}
-			else if (miniBuffer_.full() && (cs::usec(abs(miniBuffer_.median())) > cs::msec(50)))
+				setRealSampleRate(format_.rate - format_.rate / 1000);
+			}
+			else if (cs::usec(median_) < -cs::usec(300))
 			{
-				logO << "pMiniBuffer->full() && (abs(pMiniBuffer->mean()) > 50): " << miniBuffer_.median() << "\n";
-				sleep_ = cs::usec((cs::msec::rep)miniBuffer_.mean());
+				setRealSampleRate(format_.rate + format_.rate / 1000);
 			}
-		}
-
-		if (sleep_.count() != 0)
+*/		}
+		else if (shortBuffer_.full())
 		{
-			static int lastAge(0);
-			int msAge = cs::duration<cs::msec>(age);
-			if (lastAge != msAge) 
+			if (cs::usec(abs(shortMedian_)) > cs::msec(5))
 			{
-				lastAge = msAge;
-				logO << "Sleep " << cs::duration<cs::msec>(sleep_) << ", age: " << msAge << ", bufferDuration: " << cs::duration<cs::msec>(bufferDuration) << "\n";
+				logO << "pShortBuffer->full() && (abs(shortMedian_) > 5): " << shortMedian_ << "\n";
+				sleep_ = cs::usec(shortMedian_);
 			}
-		}
-		else if (shortBuffer_.full())
+/*			else
+			{
+				setRealSampleRate(format_.rate + -shortMedian_ / 100);
+			}
+*/		}
+		else if (miniBuffer_.full() && (cs::usec(abs(miniBuffer_.median())) > cs::msec(50)))
 		{
-			if (cs::usec(shortMedian_) > cs::usec(100))
-				setRealSampleRate(format_.rate * 0.9999);
-			else if (cs::usec(shortMedian_) < -cs::usec(100))
-				setRealSampleRate(format_.rate * 1.0001);
+			logO << "pMiniBuffer->full() && (abs(pMiniBuffer->mean()) > 50): " << miniBuffer_.median() << "\n";
+			sleep_ = cs::usec((cs::msec::rep)miniBuffer_.mean());
 		}
+		if (sleep_.count() != 0)
+			++resyncs_;
+	}
 
-		updateBuffers(age.count());
-
-		// print sync stats
-		time_t now = time(NULL);
-		if (now != lastUpdate_)
+	if (sleep_.count() != 0)
+	{
+		static int lastAge(0);
+		int msAge = cs::duration<cs::msec>(age);
+		if (lastAge != msAge) 
 		{
-			lastUpdate_ = now;
-			median_ = buffer_.median();
-			shortMedian_ = shortBuffer_.median();
-			logO << "Chunk: " << age.count()/100 << "\t" << miniBuffer_.median()/100 << "\t" << shortMedian_/100 << "\t" << median_/100 << "\t" << buffer_.size() << "\t" << cs::duration<cs::msec>(outputBufferDacTime) << "\n";
-//			logO << "Chunk: " << age.count()/1000 << "\t" << miniBuffer_.median()/1000 << "\t" << shortMedian_/1000 << "\t" << median_/1000 << "\t" << buffer_.size() << "\t" << cs::duration<cs::msec>(outputBufferDacTime) << "\n";
+			lastAge = msAge;
+			logO << "Sleep " << cs::duration<cs::msec>(sleep_) << ", age: " << msAge << ", bufferDuration: " << cs::duration<cs::msec>(bufferDuration) << "\n";
 		}
-		return (abs(cs::duration<cs::msec>(age)) < 500);
 	}
-	catch(int e)
+	else if (shortBuffer_.full() && (cs::usec(abs(shortMedian_)) > cs::usec(100)))
 	{
-		sleep_ = cs::usec(0);
-		return false;
+		/// steer the rate proportionally, to correct the deviation within ~5s (max. 500ppm)
+		double deviation = std::max(-0.0005, std::min(0.0005, shortMedian_ / 5000000.));
+		setRealSampleRate(format_.rate * (1. - deviation));
 	}
-}
 
+	updateBuffers(age.count());
 
+	// print sync stats
+	time_t now = time(NULL);
+	if (now != lastUpdate_)
+	{
+		lastUpdate_ = now;
+		median_ = buffer_.median();
+		shortMedian_ = shortBuffer_.median();
+		logO << "Chunk: " << age.count()/100 << "\t" << miniBuffer_.median()/100 << "\t" << shortMedian_/100 << "\t" << median_/100 << "\t" << buffer_.size() << "\t" << cs::duration<cs::msec>(outputBufferDacTime) << "\n";
+//		logO << "Chunk: " << age.count()/1000 << "\t" << miniBuffer_.median()/1000 << "\t" << shortMedian_/1000 << "\t" << median_/1000 << "\t" << buffer_.size() << "\t" << cs::duration<cs::msec>(outputBufferDacTime) << "\n";
+	}
+	return (abs(cs::duration<cs::msec>(age)) < 500);
+}
 
@@ -27,16 +27,18 @@
 
 #include <deque>
 #include <memory>
+#include <atomic>
 #include "doubleBuffer.h"
 #include "message/message.h"
 #include "message/pcmChunk.h"
 #include "common/sampleFormat.h"
-#include "common/queue.h"
+#include "pcmRing.h"
+#include "resampler.h"
 
 
 /// Time synchronized audio stream
 /**
- * Queue with PCM data.
+ * Lock-free ring with PCM data (see PcmRing), filled by the decoder, read by the player.
  * Returns "online" server-time-synchronized PCM data
  */
 class Stream
@@ -44,7 +46,7 @@ class Stream
 public:
 	Stream(const SampleFormat& format);
 
-	/// Adds PCM data to the queue
+	/// Adds PCM data to the ring. Takes ownership of the chunk
 	void addChunk(msg::PcmChunk* chunk);
 	void clearChunks();
 
@@ -53,7 +55,33 @@ public:
 	bool getPlayerChunk(void* outputBuffer, const chronos::usec& outputBufferDacTime, unsigned long framesPerBuffer);
 
 	/// "Server buffer": playout latency, e.g. 1000ms
-	void setBufferLen(size_t bufferLenMs);
+	/// smooth: move there gradually (0.5% of the playback speed) instead of resyncing
+	void setBufferLen(size_t bufferLenMs, bool smooth = false);
+
+	/// Latest delay of the audio output ("outputBufferDacTime")
+	chronos::usec getOutputDelay() const
+	{
+		return chronos::usec(outputDelay_.load());
+	}
+
+	/// Deviation of the last returned chunk from its due time, based on "outputBufferDacTime"
+	/// > 0: played too late
+	chronos::usec getLastAge() const
+	{
+		return chronos::usec(lastAge_.load());
+	}
+
+	/// Duration of the buffered PCM data
+	chronos::usec getBuffered() const
+	{
+		return ring_.duration();
+	}
+
+	/// Number of times the stream lost sync and started to correct it
+	uint32_t getResyncs() const
+	{
+		return resyncs_;
+	}
 
 	const SampleFormat& getFormat() const
 	{
@@ -63,8 +91,8 @@ public:
 	bool waitForChunk(size_t ms) const;
 
 private:
-	chronos::time_point_clk getNextPlayerChunk(void* outputBuffer, const chronos::usec& timeout, unsigned long framesPerBuffer);
-	chronos::time_point_clk getNextPlayerChunk(void* outputBuffer, const chronos::usec& timeout, unsigned long framesPerBuffer, long framesCorrection);
+	bool waitForFrames(size_t frames, const chronos::usec& timeout) const;
+	bool getNextPlayerChunk(void* outputBuffer, const chronos::usec& timeout, unsigned long framesPerBuffer, double framesCorrection, chronos::time_point_clk& start);
 	chronos::time_point_clk getSilentPlayerChunk(void* outputBuffer, unsigned long framesPerBuffer);
 	chronos::time_point_clk seek(long ms);
 //	time_point_ms seekTo(const time_point_ms& to);
@@ -76,19 +104,24 @@ private:
 
 	chronos::usec sleep_;
 
-	Queue<std::shared_ptr<msg::PcmChunk>> chunks_;
+	PcmRing ring_;
+	Resampler resampler_;
 //	DoubleBuffer<chronos::usec::rep> cardBuffer;
 	DoubleBuffer<chronos::usec::rep> miniBuffer_;
 	DoubleBuffer<chronos::usec::rep> buffer_;
 	DoubleBuffer<chronos::usec::rep> shortBuffer_;
-	std::shared_ptr<msg::PcmChunk> chunk_;
 
 	int median_;
 	int shortMedian_;
 	time_t lastUpdate_;
-	unsigned long playedFrames_;
-	long correctAfterXFrames_;
-	chronos::msec bufferMs_;
+	/// input frames per output frame, to play at the (measured) real sample rate
+	double rateRatio_;
+	chronos::usec bufferLen_;
+	std::atomic<chronos::usec::rep> targetBufferLen_;
+	std::atomic<bool> bufferJump_;
+	std::atomic<chronos::usec::rep> outputDelay_;
+	std::atomic<chronos::usec::rep> lastAge_;
+	std::atomic<uint32_t> resyncs_;
 };
 
 
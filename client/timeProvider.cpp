@@ -16,48 +16,214 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <fstream>
+#include <iomanip>
 #include "timeProvider.h"
+#include "externals/json.hpp"
 #include "common/log.h"
 
+using json = nlohmann::json;
 
-TimeProvider::TimeProvider() : diffToServer_(0)
+namespace cs = chronos;
+
+static const size_t maxSamples = 200;
+static const size_t minSkewSamples = 10;
+static const cs::usec::rep minSkewSpan = 60 * 1000000;
+static const double maxSkew = 0.0005;
+static const cs::usec::rep maxModelAge = 24ll * 3600 * 1000000;
+
+
+TimeProvider::TimeProvider() : rttBuffer_(maxSamples), seq_(0), offset_(0.), skew_(0.), reference_(0), hasSkew_(false), sampleCount_(0), hasModel_(false), priorSkew_(0.)
 {
-	diffBuffer_.setSize(200);
 }
 
 
 void TimeProvider::setDiff(const tv& c2s, const tv& s2c)
 {
-		tv latency = c2s - s2c;
-		double diff = latency.sec * 1000. + latency.usec / 1000.;
-		setDiffToServer(diff / 2.);
+	/// c2s = offset + delay to server, s2c = -offset + delay from server
+	double c2sUs = c2s.nsec / 1000.;
+	double s2cUs = s2c.nsec / 1000.;
+	double rtt = std::max(0., c2sUs + s2cUs);
+	addSample(sinceEpoche<cs::usec>(now()).count(), (c2sUs - s2cUs) / 2., rtt);
+}
+
+
+double TimeProvider::getSkew() const
+{
+	return skew_.load(std::memory_order_relaxed);
 }
 
 
-void TimeProvider::setDiffToServer(double ms)
+bool TimeProvider::hasSkew() const
 {
-	static int32_t lastTimeSync = 0;
-	timeval now;
-	gettimeofday(&now, NULL);
+	return hasSkew_;
+}
+
 
-	/// clear diffBuffer if last update is older than a minute
-	if (!diffBuffer_.empty() && (std::abs(now.tv_sec - lastTimeSync) > 60))
+size_t TimeProvider::getSampleCount() const
+{
+	return sampleCount_;
+}
+
+
+double TimeProvider::getMedianRtt()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (rttBuffer_.empty())
+		return 0.;
+	return rttBuffer_.median();
+}
+
+
+void TimeProvider::load(const std::string& filename, const std::string& server)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	try
 	{
-		logO << "Last time sync older than a minute. Clearing time buffer\n";
-		diffToServer_ = ms*1000;
-		diffBuffer_.clear();
+		std::ifstream ifs(filename, std::ifstream::in);
+		if (!ifs.good())
+			return;
+		json j;
+		ifs >> j;
+		json jServer = j["TimeSync"][server];
+		if (jServer.is_null())
+			return;
+
+		cs::usec::rep reference = jServer["reference"].get<cs::usec::rep>();
+		double skew = jServer["skew"].get<double>();
+		/// the clocks are monotonic, a reference in the future means that the client has been rebooted
+		cs::usec::rep age = sinceEpoche<cs::usec>(now()).count() - reference;
+		if ((age < 0) || (age > maxModelAge))
+			return;
+
+		priorSkew_ = std::max(-maxSkew, std::min(maxSkew, skew));
+		hasModel_ = true;
+		publish(jServer["offset"].get<double>(), priorSkew_, reference);
+		logO << "Restored time model for " << server << ", diff to server [ms]: " << getDiffToServer<cs::usec>().count() / 1000. << ", skew: " << priorSkew_ * 1000000. << "ppm\n";
 	}
-	lastTimeSync = now.tv_sec;
+	catch(const std::exception& e)
+	{
+		logE << "Error reading time model: " << e.what() << "\n";
+	}
+}
+
 
-	diffBuffer_.add(ms*1000);
-	diffToServer_ = diffBuffer_.median(3);
-//	logO << "setDiffToServer: " << ms << ", diff: " << diffToServer_ / 1000.f << "\n";
+void TimeProvider::save(const std::string& filename, const std::string& server)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!hasModel_)
+		return;
+
+	json j;
+	try
+	{
+		std::ifstream ifs(filename, std::ifstream::in);
+		if (ifs.good())
+			ifs >> j;
+	}
+	catch(...)
+	{
+		j = json();
+	}
+
+	cs::usec::rep reference = sinceEpoche<cs::usec>(now()).count();
+	j["TimeSync"][server] = {
+		{"offset", offsetAt(reference)},
+		{"skew", skew_.load(std::memory_order_relaxed)},
+		{"reference", reference}
+	};
+	std::ofstream ofs(filename.c_str(), std::ofstream::out|std::ofstream::trunc);
+	ofs << std::setw(4) << j;
+}
+
+
+void TimeProvider::publish(double offset, double skew, cs::usec::rep reference)
+{
+	uint32_t seq = seq_.load(std::memory_order_relaxed);
+	seq_.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	offset_.store(offset, std::memory_order_relaxed);
+	skew_.store(skew, std::memory_order_relaxed);
+	reference_.store(reference, std::memory_order_relaxed);
+	seq_.store(seq + 2, std::memory_order_release);
+}
+
+
+double TimeProvider::offsetAt(cs::usec::rep local) const
+{
+	uint32_t seq;
+	double offset, skew;
+	cs::usec::rep reference;
+	do
+	{
+		seq = seq_.load(std::memory_order_acquire);
+		offset = offset_.load(std::memory_order_relaxed);
+		skew = skew_.load(std::memory_order_relaxed);
+		reference = reference_.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}
+	while ((seq & 1) || (seq != seq_.load(std::memory_order_relaxed)));
+	return offset + skew * (local - reference);
 }
 
-/*
-long TimeProvider::getPercentileDiffToServer(size_t percentile)
+
+void TimeProvider::addSample(cs::usec::rep local, double offset, double rtt)
 {
-	return diffBuffer.percentile(percentile);
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	/// a sample far off the model (more than the measurement's uncertainty) means that a clock has been set
+	if (hasModel_ && (fabs(offset - offsetAt(local)) > rtt / 2. + 10000.))
+	{
+		logO << "Time sync sample off by " << (offset - offsetAt(local)) / 1000. << "ms, rtt: " << rtt / 1000. << "ms. Clearing time buffer\n";
+		samples_.clear();
+		rttBuffer_.clear();
+		priorSkew_ = 0.;
+	}
+	++sampleCount_;
+
+	samples_.push_back({local, offset, rtt});
+	rttBuffer_.add(rtt);
+	if (samples_.size() > maxSamples)
+		samples_.pop_front();
+
+	/// least squares fit over the samples with the lower half of the round trip times
+	double rttLimit = rttBuffer_.median();
+	cs::usec::rep reference = samples_.back().local;
+	size_t n = 0;
+	double sumX = 0., sumY = 0.;
+	cs::usec::rep first = reference;
+	for (const auto& sample: samples_)
+	{
+		if (sample.rtt > rttLimit)
+			continue;
+		++n;
+		sumX += sample.local - reference;
+		sumY += sample.offset;
+		first = std::min(first, sample.local);
+	}
+	double meanX = sumX / n;
+	double meanY = sumY / n;
+
+	double skew = priorSkew_;
+	bool hasSkew = ((n >= minSkewSamples) && (reference - first >= minSkewSpan));
+	if (hasSkew)
+	{
+		double sumXX = 0., sumXY = 0.;
+		for (const auto& sample: samples_)
+		{
+			if (sample.rtt > rttLimit)
+				continue;
+			double x = (sample.local - reference) - meanX;
+			sumXX += x * x;
+			sumXY += x * (sample.offset - meanY);
+		}
+		skew = std::max(-maxSkew, std::min(maxSkew, sumXY / sumXX));
+	}
+	hasSkew_ = hasSkew;
+	hasModel_ = true;
+
+	/// offset at the reference (the latest sample), extrapolated from the mean
+	publish(meanY - skew * meanX, skew, reference);
+//	logO << "offset: " << (meanY - skew * meanX) / 1000. << "ms, skew: " << skew * 1000000. << "ppm, samples: " << n << "\n";
 }
-*/
 
@@ -21,6 +21,10 @@
 
 #include <atomic>
 #include <chrono>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <string>
 #include "doubleBuffer.h"
 #include "message/message.h"
 #include "common/timeDefs.h"
@@ -28,28 +32,57 @@
 
 /// Provides local and server time
 /**
- * Stores time difference to the server
- * Returns server's local system time.
+ * Estimates the time difference to the server and the clock rate skew between client and server
+ * Returns server's local time (of its monotonic clock, see chronos::clk).
  * Clients are using the server time to play audio in sync, independent of the client's system time
+ *
+ * The model is a line offset(t) = offset + skew * (t - reference), fitted (least squares) to the
+ * samples with the lower half of the round trip times, out of the last 200 time sync replies.
+ * The skew is only estimated once the samples span at least a minute, and it is limited to +-500ppm.
+ * The model is published with a sequence lock: serverNow() is lock-free and never blocks the player.
+ * A loaded (saved) model is used until the samples allow a fit of their own; its skew is kept
+ * until the skew can be estimated.
  */
 class TimeProvider
 {
 public:
+	/// The client uses the singleton, a relay stream has its own instance per upstream server
+	TimeProvider();
+
 	static TimeProvider& getInstance()
 	{
 		static TimeProvider instance;
 		return instance;
 	}
 
-	void setDiffToServer(double ms);
+	/// Adds a time sync reply. c2s: client to server diff (server receive - client send),
+	/// s2c: server to client diff (client receive - server send)
 	void setDiff(const tv& c2s, const tv& s2c);
 
 	template<typename T>
 	inline T getDiffToServer() const
 	{
-		return std::chrono::duration_cast<T>(chronos::usec(diffToServer_));
+		return std::chrono::duration_cast<T>(chronos::usec((chronos::usec::rep)llround(offsetAt(sinceEpoche<chronos::usec>(now()).count()))));
 	}
 
+	/// Estimated clock skew (server rate / client rate - 1)
+	double getSkew() const;
+
+	/// true if the skew is known, i.e. the model can extrapolate and time sync can be sparse
+	bool hasSkew() const;
+
+	/// Number of time sync replies received so far
+	size_t getSampleCount() const;
+
+	/// Median round trip time of the recent time sync replies [us]
+	double getMedianRtt();
+
+	/// Restores the model last saved for "server" (if not older than a day) as a starting point
+	void load(const std::string& filename, const std::string& server);
+
+	/// Saves the current model for "server" (other servers' entries in the file are kept)
+	void save(const std::string& filename, const std::string& server);
+
 /*	chronos::usec::rep getDiffToServer();
 	chronos::usec::rep getPercentileDiffToServer(size_t percentile);
 	long getDiffToServerMs();
@@ -63,7 +96,7 @@ public:
 
 	static chronos::time_point_clk toTimePoint(const tv& timeval)
 	{
-		return chronos::time_point_clk(chronos::usec(timeval.usec) + chronos::sec(timeval.sec));
+		return timeval.toTimePoint();
 	}
 
 	inline static chronos::time_point_clk now()
@@ -77,12 +110,36 @@ public:
 	}
 
 private:
-	TimeProvider();
 	TimeProvider(TimeProvider const&);   // Don't Implement
 	void operator=(TimeProvider const&); // Don't implement
 
-	DoubleBuffer<chronos::usec::rep> diffBuffer_;
-	std::atomic<chronos::usec::rep> diffToServer_;
+	struct Sample
+	{
+		chronos::usec::rep local;
+		double offset;
+		double rtt;
+	};
+
+	/// Adds a sample [us] and refits the model
+	void addSample(chronos::usec::rep local, double offset, double rtt);
+	void publish(double offset, double skew, chronos::usec::rep reference);
+	double offsetAt(chronos::usec::rep local) const;
+
+	std::mutex mutex_;
+	std::deque<Sample> samples_;
+	DoubleBuffer<double> rttBuffer_;
+
+	/// the model, guarded by the sequence lock seq_ (odd while being written)
+	std::atomic<uint32_t> seq_;
+	std::atomic<double> offset_;
+	std::atomic<double> skew_;
+	std::atomic<chronos::usec::rep> reference_;
+	std::atomic<bool> hasSkew_;
+	std::atomic<size_t> sampleCount_;
+	/// model is valid (loaded or fitted)
+	bool hasModel_;
+	/// skew of a loaded model
+	double priorSkew_;
 };
 
 
@@ -0,0 +1,112 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sstream>
+#include "timeSyncClient.h"
+#include "timeProvider.h"
+#include "message/time.h"
+#include "common/log.h"
+#include "common/socketTimestamp.h"
+#include "common/strCompat.h"
+
+using namespace std;
+
+
+TimeSyncClient::TimeSyncClient(const std::string& host, size_t port) : host_(host), port_(port), socket_(ioService_), reqId_(1), active_(false)
+{
+}
+
+
+TimeSyncClient::~TimeSyncClient()
+{
+	stop();
+}
+
+
+void TimeSyncClient::start()
+{
+	udp::resolver resolver(ioService_);
+	udp::resolver::query query(udp::v4(), host_, cpt::to_string(port_), asio::ip::resolver_query_base::numeric_service);
+	udp::endpoint endpoint = *resolver.resolve(query);
+	socket_.open(udp::v4());
+	socket_.connect(endpoint);
+	if (!enableReceiveTimestamps(socket_.native_handle()))
+		logO << "Time sync: kernel receive timestamps not available\n";
+	logO << "Time sync via UDP " << endpoint.address().to_string() << ":" << port_ << "\n";
+	active_ = true;
+	readerThread_ = thread(&TimeSyncClient::reader, this);
+}
+
+
+void TimeSyncClient::stop()
+{
+	if (!active_)
+		return;
+	active_ = false;
+	std::error_code ec;
+	/// wakes up the blocking receive
+	socket_.shutdown(udp::socket::shutdown_both, ec);
+	socket_.close(ec);
+	readerThread_.join();
+}
+
+
+void TimeSyncClient::sendRequest()
+{
+	std::lock_guard<std::mutex> lock(sendMutex_);
+	msg::Time request;
+	request.id = reqId_++;
+	request.sent = tv();
+	/// datagrams use the current protocol version
+	std::ostringstream stream;
+	request.serialize(stream, msg::protocolVersion);
+	string data = stream.str();
+	std::error_code ec;
+	socket_.send(asio::buffer(data), 0, ec);
+}
+
+
+void TimeSyncClient::reader()
+{
+	char buffer[256];
+	msg::BaseMessage baseMessage;
+	while (active_)
+	{
+		tv received;
+		ssize_t size = receiveTimestamped(socket_.native_handle(), buffer, sizeof(buffer), received);
+		if (!active_)
+			break;
+		if (size < 0)
+		{
+			/// e.g. ECONNREFUSED: ICMP port unreachable for an earlier request
+			chronos::sleep(100);
+			continue;
+		}
+
+		if ((size_t)size < baseMessage.getSize())
+			continue;
+		baseMessage.deserialize(buffer, msg::protocolVersion);
+		if ((baseMessage.type != message_type::kTime) || (baseMessage.getSize() + baseMessage.size > (size_t)size))
+			continue;
+		baseMessage.received = received;
+		msg::Time reply;
+		reply.deserialize(baseMessage, buffer + baseMessage.getSize());
+		TimeProvider::getInstance().setDiff(reply.latency, reply.received - reply.sent);
+	}
+}
+
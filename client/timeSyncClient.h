@@ -0,0 +1,63 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef TIME_SYNC_CLIENT_H
+#define TIME_SYNC_CLIENT_H
+
+#include <asio.hpp>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+using asio::ip::udp;
+
+
+/// Time sync over UDP with the server's TimeSyncServer
+/**
+ * Requests are sent with sendRequest, replies are stamped by the kernel on reception
+ * (SO_TIMESTAMPNS) and passed to the TimeProvider on a reader thread.
+ * Unlike time sync on the server connection, the samples don't queue behind audio data
+ */
+class TimeSyncClient
+{
+public:
+	TimeSyncClient(const std::string& host, size_t port);
+	~TimeSyncClient();
+
+	void start();
+	void stop();
+
+	void sendRequest();
+
+private:
+	void reader();
+
+	std::string host_;
+	size_t port_;
+	asio::io_service ioService_;
+	udp::socket socket_;
+	std::mutex sendMutex_;
+	uint16_t reqId_;
+	std::atomic<bool> active_;
+	std::thread readerThread_;
+};
+
+
+#endif
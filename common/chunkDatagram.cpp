@@ -0,0 +1,290 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <cstring>
+#include <algorithm>
+#include "chunkDatagram.h"
+
+using namespace std;
+using namespace datagram;
+
+
+static void put16(char* to, uint16_t val)
+{
+	to[0] = val & 0xff;
+	to[1] = (val >> 8) & 0xff;
+}
+
+
+static void put32(char* to, uint32_t val)
+{
+	put16(to, val & 0xffff);
+	put16(to + 2, val >> 16);
+}
+
+
+static uint16_t get16(const char* from)
+{
+	return (uint8_t)from[0] | ((uint16_t)(uint8_t)from[1] << 8);
+}
+
+
+static uint32_t get32(const char* from)
+{
+	return get16(from) | ((uint32_t)get16(from + 2) << 16);
+}
+
+
+/// Timestamp of a serialized WireChunk, datagrams are serialized with the current protocol version
+static tv getTimestamp(std::vector<char>& data)
+{
+	msg::BaseMessage baseMessage;
+	if (data.size() < baseMessage.getSize() + sizeof(int64_t))
+		return tv(0);
+	baseMessage.deserialize(data.data(), msg::protocolVersion);
+	if (baseMessage.type != message_type::kWireChunk)
+		return tv(0);
+	int64_t nsec;
+	memcpy(&nsec, data.data() + baseMessage.getSize(), sizeof(int64_t));
+	return tv((int64_t)SWAP_64(nsec));
+}
+
+
+
+DatagramEncoder::DatagramEncoder(uint8_t fecGroup) : fecGroup_(fecGroup < 2 ? 0 : fecGroup), datagramSeq_(0)
+{
+}
+
+
+std::vector<Datagram> DatagramEncoder::encode(uint32_t chunkSeq, const char* data, size_t size)
+{
+	std::vector<Datagram> result;
+	uint16_t fragments = std::max((size_t)1, (size + maxPayload - 1) / maxPayload);
+	for (uint16_t fragment=0; fragment<fragments; ++fragment)
+	{
+		size_t offset = fragment * maxPayload;
+		size_t len = std::min(maxPayload, size - offset);
+		Datagram datagram(headerSize + fragmentHeaderSize + len, 0);
+		datagram[0] = kData;
+		datagram[1] = fecGroup_;
+		put32(&datagram[4], datagramSeq_);
+		put32(&datagram[8], chunkSeq);
+		put16(&datagram[12], fragment);
+		put16(&datagram[14], fragments);
+		put16(&datagram[16], len);
+		memcpy(&datagram[18], data + offset, len);
+		result.push_back(datagram);
+
+		if (fecGroup_ != 0)
+		{
+			if (datagramSeq_ % fecGroup_ == 0)
+				parity_.clear();
+			if (parity_.size() < datagram.size() - headerSize)
+				parity_.resize(datagram.size() - headerSize, 0);
+			for (size_t n=headerSize; n<datagram.size(); ++n)
+				parity_[n - headerSize] ^= datagram[n];
+
+			if (datagramSeq_ % fecGroup_ == (uint32_t)fecGroup_ - 1)
+			{
+				Datagram parity(headerSize + parity_.size(), 0);
+				parity[0] = kParity;
+				parity[1] = fecGroup_;
+				put32(&parity[4], datagramSeq_ - (fecGroup_ - 1));
+				memcpy(&parity[headerSize], parity_.data(), parity_.size());
+				result.push_back(parity);
+			}
+		}
+		++datagramSeq_;
+	}
+	return result;
+}
+
+
+
+DatagramDecoder::DatagramDecoder() : fecGroup_(0), started_(false), nextChunk_(0), recovered_(0), lost_(0)
+{
+}
+
+
+void DatagramDecoder::add(const char* data, size_t size, const tv& received)
+{
+	if (size < headerSize)
+		return;
+
+	uint8_t type = data[0];
+	uint8_t fecGroup = data[1];
+	uint32_t datagramSeq = get32(data + 4);
+	if (type == kData)
+	{
+		if (size < headerSize + fragmentHeaderSize)
+			return;
+		addFragment(data + headerSize, size - headerSize, received);
+		if (fecGroup < 2)
+			return;
+		uint32_t groupStart = datagramSeq - datagramSeq % fecGroup;
+		groups_[groupStart].datagrams[datagramSeq].assign(data + headerSize, data + size);
+		fecGroup_ = fecGroup;
+		recover(groupStart, received);
+	}
+	else if ((type == kParity) && (fecGroup >= 2))
+	{
+		groups_[datagramSeq].parity.assign(data + headerSize, data + size);
+		fecGroup_ = fecGroup;
+		recover(datagramSeq, received);
+	}
+
+	/// groups are complete (or lost) after a few more groups
+	while (groups_.size() > 16)
+		groups_.erase(groups_.begin());
+}
+
+
+void DatagramDecoder::recover(uint32_t groupStart, const tv& received)
+{
+	Group& group = groups_[groupStart];
+	if (group.recovered || group.parity.empty() || (group.datagrams.size() + 1 != fecGroup_))
+		return;
+
+	/// all but one datagram and the parity: XOR them to get the missing one
+	group.recovered = true;
+	std::vector<char> missing(group.parity);
+	for (const auto& datagram: group.datagrams)
+	{
+		for (size_t n=0; n<datagram.second.size() && n<missing.size(); ++n)
+			missing[n] ^= datagram.second[n];
+	}
+	if (missing.size() < fragmentHeaderSize)
+		return;
+	size_t size = fragmentHeaderSize + get16(&missing[8]);
+	if (size > missing.size())
+		return;
+	++recovered_;
+	addFragment(missing.data(), size, received);
+}
+
+
+void DatagramDecoder::addFragment(const char* data, size_t size, const tv& received)
+{
+	uint32_t chunkSeq = get32(data);
+	uint16_t fragment = get16(data + 4);
+	uint16_t fragments = get16(data + 6);
+	uint16_t len = get16(data + 8);
+	if ((fragmentHeaderSize + len > size) || (fragment >= fragments) || (fragments > maxFragments))
+		return;
+
+	if (!started_)
+	{
+		started_ = true;
+		nextChunk_ = chunkSeq;
+	}
+	if (!isExpected(chunkSeq))
+		return;
+	if ((assemblies_.size() >= maxAssemblies) && (assemblies_.find(chunkSeq) == assemblies_.end()))
+		return;
+
+	Assembly& assembly = assemblies_[chunkSeq];
+	assembly.fragments[fragment].assign(data + fragmentHeaderSize, data + fragmentHeaderSize + len);
+	if (assembly.fragments.size() != fragments)
+		return;
+
+	Message& message = complete_[chunkSeq];
+	for (const auto& part: assembly.fragments)
+		message.data.insert(message.data.end(), part.second.begin(), part.second.end());
+	message.received = received;
+	message.timestamp = getTimestamp(message.data);
+	assemblies_.erase(chunkSeq);
+}
+
+
+bool DatagramDecoder::isExpected(uint32_t chunkSeq) const
+{
+	/// stray or foreign datagrams can carry any chunk number
+	if ((chunkSeq < nextChunk_) || (chunkSeq - nextChunk_ >= chunkWindow))
+		return false;
+	return (complete_.find(chunkSeq) == complete_.end());
+}
+
+
+void DatagramDecoder::addRepair(uint32_t chunkSeq, Message&& message)
+{
+	if (!started_ || !isExpected(chunkSeq))
+		return;
+	message.timestamp = getTimestamp(message.data);
+	complete_[chunkSeq] = std::move(message);
+	assemblies_.erase(chunkSeq);
+}
+
+
+bool DatagramDecoder::pop(Message& message, const tv& due)
+{
+	if (complete_.empty())
+		return false;
+
+	auto first = complete_.begin();
+	if (first->first != nextChunk_)
+	{
+		/// wait for the missing chunks, unless the chunk after them must be played now
+		if (first->second.timestamp.nsec > due.nsec)
+			return false;
+		lost_ += first->first - nextChunk_;
+		nextChunk_ = first->first;
+	}
+
+	message = std::move(first->second);
+	complete_.erase(first);
+	++nextChunk_;
+	while (!assemblies_.empty() && (assemblies_.begin()->first < nextChunk_))
+		assemblies_.erase(assemblies_.begin());
+	while (!reported_.empty() && (*reported_.begin() < nextChunk_))
+		reported_.erase(reported_.begin());
+	return true;
+}
+
+
+std::vector<uint32_t> DatagramDecoder::getMissing(const tv& due, const tv& repairLead)
+{
+	std::vector<uint32_t> result;
+	if (complete_.empty())
+		return result;
+
+	/// chunks within the last FEC group might still be recovered, unless they are needed earlier
+	uint32_t newest = complete_.rbegin()->first;
+	auto next = complete_.begin();
+	for (uint32_t chunkSeq = nextChunk_; chunkSeq < newest; ++chunkSeq)
+	{
+		if (next->first == chunkSeq)
+		{
+			++next;
+			continue;
+		}
+		/// a missing chunk is due not later than the next complete one
+		const tv& timestamp = next->second.timestamp;
+		if ((chunkSeq + std::max((uint8_t)1, fecGroup_) >= newest) && (timestamp.nsec > due.nsec + repairLead.nsec))
+			continue;
+		if (reported_.insert(chunkSeq).second && (timestamp.nsec > due.nsec))
+			result.push_back(chunkSeq);
+	}
+	return result;
+}
+
+
+uint32_t DatagramDecoder::expand(uint16_t chunkSeq) const
+{
+	return nextChunk_ + (int16_t)(chunkSeq - (uint16_t)nextChunk_);
+}
+
@@ -0,0 +1,156 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef CHUNK_DATAGRAM_H
+#define CHUNK_DATAGRAM_H
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <set>
+#include "message/message.h"
+
+
+/// Datagram transport of serialized messages (i.e. WireChunks)
+/**
+ * Every message gets a chunk sequence number and is split into fragments of at most
+ * maxPayload bytes, one per datagram. Datagrams carry their own sequence number.
+ * With FEC every "fecGroup" consecutive data datagrams are followed by a parity datagram,
+ * the XOR of their (zero padded) fragment headers and payloads, which recovers one lost
+ * datagram of the group.
+ * All values are little endian:
+ *   uint8  type (data or parity)
+ *   uint8  fecGroup (0: no FEC)
+ *   uint16 reserved
+ *   uint32 datagram sequence number (parity: the one of the group's first datagram)
+ *   data:   uint32 chunk sequence number, uint16 fragment, uint16 fragments, uint16 size, payload
+ *   parity: XOR of the data datagrams from the chunk sequence number on
+ */
+namespace datagram
+{
+
+const uint8_t kData = 0;
+const uint8_t kParity = 1;
+const size_t headerSize = 8;
+const size_t fragmentHeaderSize = 10;
+const size_t maxPayload = 1400;
+/// Chunks the sender keeps for repairs (~5s of 20ms chunks), the receiver
+/// drops chunks further ahead of the next expected one
+const uint32_t chunkWindow = 256;
+/// Chunks reassembled at the same time and fragments per chunk, further fragments are dropped
+const size_t maxAssemblies = 32;
+const uint16_t maxFragments = 512;
+
+typedef std::vector<char> Datagram;
+
+/// A reassembled message with the time the last of its datagrams arrived
+struct Message
+{
+	std::vector<char> data;
+	tv received;
+	/// WireChunk timestamp (server time), 0 for other messages
+	tv timestamp;
+};
+
+}
+
+
+/// Splits messages into datagrams and adds parity datagrams
+class DatagramEncoder
+{
+public:
+	/// fecGroup: data datagrams per parity datagram, < 2: no FEC
+	DatagramEncoder(uint8_t fecGroup = 0);
+
+	/// Datagrams (data and parity) to send for the message
+	std::vector<datagram::Datagram> encode(uint32_t chunkSeq, const char* data, size_t size);
+
+private:
+	uint8_t fecGroup_;
+	uint32_t datagramSeq_;
+	std::vector<char> parity_;
+};
+
+
+/// Recovers and reassembles messages and returns them in chunk order
+/**
+ * A missing chunk holds back the following ones until it is recovered (FEC or addRepair)
+ * or the next complete chunk is due, then it is skipped.
+ * Only chunks within chunkWindow of the next expected chunk are accepted.
+ */
+class DatagramDecoder
+{
+public:
+	DatagramDecoder();
+
+	void add(const char* data, size_t size, const tv& received);
+	/// A message that was retransmitted on another channel
+	void addRepair(uint32_t chunkSeq, datagram::Message&& message);
+	/// Next message in chunk order. Missing chunks are skipped if the chunk after them
+	/// is due, i.e. its timestamp is not after "due"
+	bool pop(datagram::Message& message, const tv& due);
+
+	/// Chunks to request, each reported once: the ones that can't be recovered by FEC anymore
+	/// or that would be due (see pop) before FEC could recover them, i.e. within "repairLead".
+	/// Chunks that are due already are not requested
+	std::vector<uint32_t> getMissing(const tv& due, const tv& repairLead);
+	/// Full chunk sequence number of a truncated (16 bit) one, next to the expected chunk
+	uint32_t expand(uint16_t chunkSeq) const;
+
+	size_t getRecovered() const
+	{
+		return recovered_;
+	}
+
+	size_t getLost() const
+	{
+		return lost_;
+	}
+
+private:
+	struct Group
+	{
+		Group() : recovered(false) {};
+		std::map<uint32_t, std::vector<char>> datagrams;
+		std::vector<char> parity;
+		bool recovered;
+	};
+
+	struct Assembly
+	{
+		std::map<uint16_t, std::vector<char>> fragments;
+	};
+
+	void addFragment(const char* data, size_t size, const tv& received);
+	/// Not yet complete and within chunkWindow of the next expected chunk
+	bool isExpected(uint32_t chunkSeq) const;
+	void recover(uint32_t groupStart, const tv& received);
+
+	uint8_t fecGroup_;
+	bool started_;
+	uint32_t nextChunk_;
+	std::map<uint32_t, Group> groups_;
+	std::map<uint32_t, Assembly> assemblies_;
+	std::map<uint32_t, datagram::Message> complete_;
+	std::set<uint32_t> reported_;
+	size_t recovered_;
+	size_t lost_;
+};
+
+
+#endif
@@ -0,0 +1,68 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef DELTA_CODEC_H
+#define DELTA_CODEC_H
+
+#include <cstdint>
+
+
+/// Shared definitions of the "delta" codec
+/**
+ * Lightweight lossless codec, optimized for decode speed on low-end clients.
+ * Every chunk is self contained:
+ *   uint32 frame count
+ *   int32  first sample of every channel (warm-up)
+ *   blocks of up to blockFrames frames. Per block and channel:
+ *     uint8  (order << 6) | width
+ *     residuals of a fixed order 1 or 2 predictor, zigzag coded and
+ *     bit packed LSB first with "width" bits per residual, padded to full bytes
+ * All multi-byte values are little endian.
+ */
+namespace delta
+{
+
+const uint32_t blockFrames = 128;
+const uint8_t widthMask = 0x3f;
+const uint8_t orderShift = 6;
+
+inline uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline uint8_t bitWidth(uint64_t value)
+{
+	uint8_t width = 0;
+	while (value != 0)
+	{
+		++width;
+		value >>= 1;
+	}
+	return width;
+}
+
+}
+
+
+#endif
@@ -0,0 +1,89 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef SOCKET_TIMESTAMP_H
+#define SOCKET_TIMESTAMP_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "message/message.h"
+
+
+/// Enables kernel receive timestamps on a datagram socket, false if not supported
+inline bool enableReceiveTimestamps(int fd)
+{
+#ifdef SO_TIMESTAMPNS
+	int enable = 1;
+	return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == 0);
+#else
+	return false;
+#endif
+}
+
+
+/// Receives a datagram (blocking) with the time it arrived at the network stack
+/**
+ * The kernel stamps the datagram with the system (realtime) clock, it is converted to
+ * chronos::clk by its age. Without kernel timestamp, "received" is the current time.
+ * Returns the datagram's size or -1 on error
+ */
+inline ssize_t receiveTimestamped(int fd, char* buffer, size_t size, tv& received, sockaddr* from = NULL, socklen_t* fromLen = NULL)
+{
+	iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+	char control[256];
+	msghdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_name = from;
+	hdr.msg_namelen = (fromLen != NULL) ? *fromLen : 0;
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control;
+	hdr.msg_controllen = sizeof(control);
+
+	ssize_t result = recvmsg(fd, &hdr, 0);
+	received = tv();
+	if (result < 0)
+		return result;
+	if (fromLen != NULL)
+		*fromLen = hdr.msg_namelen;
+
+#ifdef SO_TIMESTAMPNS
+	for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+	{
+		if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_TIMESTAMPNS))
+			continue;
+		timespec stamp;
+		memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+		timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		int64_t age = (now.tv_sec - stamp.tv_sec) * 1000000000ll + (now.tv_nsec - stamp.tv_nsec);
+		/// a step of the system time in between would give an implausible age
+		if ((age >= 0) && (age < 1000000000ll))
+			received = received - tv(age);
+		break;
+	}
+#endif
+	return result;
+}
+
+
+#endif
+
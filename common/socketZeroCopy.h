@@ -0,0 +1,146 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef SOCKET_ZERO_COPY_H
+#define SOCKET_ZERO_COPY_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+#include "common/snapException.h"
+#include "common/strCompat.h"
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAS_ZERO_COPY
+#endif
+
+
+/// Enables MSG_ZEROCOPY sends on a TCP socket, false if not supported (Linux >= 4.14)
+inline bool enableZeroCopy(int fd)
+{
+#ifdef HAS_ZERO_COPY
+	int enable = 1;
+	return (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0);
+#else
+	return false;
+#endif
+}
+
+
+/// Writes all buffers with sendmsg, i.e. without copying them into one buffer first
+/**
+ * With "zeroCopy" the kernel sends the data from the buffers (MSG_ZEROCOPY): they must not
+ * change until readZeroCopyCompletions reports the send as completed.
+ * Returns the number of zero copy sends, each of them gets a completion. Throws on error
+ */
+inline uint32_t sendAll(int fd, std::vector<iovec>& iov, bool zeroCopy)
+{
+	uint32_t zeroCopySends = 0;
+	size_t first = 0;
+	while (first < iov.size())
+	{
+		msghdr hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_iov = &iov[first];
+		hdr.msg_iovlen = iov.size() - first;
+		int flags = MSG_NOSIGNAL;
+#ifdef HAS_ZERO_COPY
+		if (zeroCopy)
+			flags |= MSG_ZEROCOPY;
+#endif
+		ssize_t count = sendmsg(fd, &hdr, flags);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			/// out of locked memory for zero copy sends
+			if ((errno == ENOBUFS) && zeroCopy)
+			{
+				zeroCopy = false;
+				continue;
+			}
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				pollfd pfd = {fd, POLLOUT, 0};
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			throw SnapException("sendmsg failed: " + cpt::to_string(errno));
+		}
+		if (zeroCopy)
+			++zeroCopySends;
+
+		/// skip what has been sent, continue with the rest of a partially sent buffer
+		size_t sent = count;
+		while ((first < iov.size()) && (sent >= iov[first].iov_len))
+			sent -= iov[first++].iov_len;
+		if (first < iov.size())
+		{
+			iov[first].iov_base = (char*)iov[first].iov_base + sent;
+			iov[first].iov_len -= sent;
+		}
+	}
+	return zeroCopySends;
+}
+
+
+/// Reads the zero copy completions from the socket's error queue (non-blocking)
+/**
+ * Sends are counted from 0 on, "completed" is set to the last completed one.
+ * "copied" is set if the kernel copied the data anyway (e.g. on loopback), i.e. zero copy doesn't pay.
+ * Returns false if there was no completion
+ */
+inline bool readZeroCopyCompletions(int fd, uint32_t& completed, bool& copied)
+{
+	bool result = false;
+#ifdef HAS_ZERO_COPY
+	while (true)
+	{
+		char control[128];
+		msghdr hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_control = control;
+		hdr.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &hdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+		{
+			sock_extended_err err;
+			memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+			if ((err.ee_errno != 0) || (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+				continue;
+			/// [ee_info, ee_data] completed, completions of a TCP socket are in order
+			completed = err.ee_data;
+			if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				copied = true;
+			result = true;
+		}
+	}
+#endif
+	return result;
+}
+
+
+#endif
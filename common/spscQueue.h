@@ -0,0 +1,91 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+
+/// Bounded lock-free queue for exactly one producer and one consumer thread
+/**
+ * The capacity is rounded up to a power of two.
+ * try_push is only called by the producer, try_pop only by the consumer.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+	SpscQueue(size_t capacity) : head_(0), tail_(0)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		buffer_.resize(size);
+		mask_ = size - 1;
+	}
+
+	bool try_push(T&& item)
+	{
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_.load(std::memory_order_acquire) > mask_)
+			return false;
+		buffer_[tail & mask_] = std::move(item);
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool try_pop(T& item)
+	{
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire))
+			return false;
+		item = std::move(buffer_[head & mask_]);
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return (head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire));
+	}
+
+	size_t size() const
+	{
+		return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const
+	{
+		return mask_ + 1;
+	}
+
+private:
+	std::vector<T> buffer_;
+	size_t mask_;
+	/// consumer and producer index on separate cache lines
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) std::atomic<size_t> tail_;
+};
+
+
+#endif
+
+
@@ -29,7 +29,8 @@
 
 namespace chronos
 {
-	typedef std::chrono::system_clock clk;
+	/// monotonic: timestamps exchanged with the server are not affected by steps of the system time
+	typedef std::chrono::steady_clock clk;
 	typedef std::chrono::time_point<clk> time_point_clk;
 	typedef std::chrono::seconds sec;
 	typedef std::chrono::milliseconds msec;
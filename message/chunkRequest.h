@@ -0,0 +1,59 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef CHUNK_REQUEST_H
+#define CHUNK_REQUEST_H
+
+#include "jsonMessage.h"
+#include <vector>
+
+
+namespace msg
+{
+
+/// Client to server: chunks (sequence numbers) that got lost on the datagram channel
+/**
+ * The server resends them as WireChunks, with the lower 16 bits of the sequence number as id
+ */
+class ChunkRequest : public JsonMessage
+{
+public:
+	ChunkRequest() : JsonMessage(message_type::kChunkRequest)
+	{
+		setChunks(std::vector<uint32_t>());
+	}
+
+	virtual ~ChunkRequest()
+	{
+	}
+
+	std::vector<uint32_t> getChunks()
+	{
+		return get("chunks", std::vector<uint32_t>());
+	}
+
+	void setChunks(const std::vector<uint32_t>& chunks)
+	{
+		msg["chunks"] = chunks;
+	}
+};
+
+}
+
+
+#endif
@@ -0,0 +1,94 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef CLIENT_STATS_H
+#define CLIENT_STATS_H
+
+#include "message.h"
+
+namespace msg
+{
+
+/// Client to server: playback statistics, sent periodically (protocol version 5)
+/**
+ * Counters and times refer to the interval since the previous report
+ */
+class ClientStats : public BaseMessage
+{
+public:
+	ClientStats() : BaseMessage(message_type::kClientStats), bufferMs(0), medianAgeMs(0), syncErrorUs(0), xruns(0), resyncs(0), decodeUs(0), maxDecodeUs(0), rttUs(0)
+	{
+	}
+
+	virtual ~ClientStats()
+	{
+	}
+
+	virtual void read(std::istream& stream)
+	{
+		readVal(stream, bufferMs);
+		readVal(stream, medianAgeMs);
+		readVal(stream, syncErrorUs);
+		readVal(stream, xruns);
+		readVal(stream, resyncs);
+		readVal(stream, decodeUs);
+		readVal(stream, maxDecodeUs);
+		readVal(stream, rttUs);
+	}
+
+	virtual uint32_t getSize() const
+	{
+		return 8*sizeof(int32_t);
+	}
+
+	/// PCM buffered in the client
+	int32_t bufferMs;
+	/// median arrival age of the chunks (server time of arrival - timestamp)
+	int32_t medianAgeMs;
+	/// deviation of the playout from the due time (> 0: late)
+	int32_t syncErrorUs;
+	/// player buffer underruns
+	uint32_t xruns;
+	/// times the stream lost sync and had to be corrected
+	uint32_t resyncs;
+	/// mean and max. decode time per chunk
+	uint32_t decodeUs;
+	uint32_t maxDecodeUs;
+	/// median round trip time of the time sync
+	uint32_t rttUs;
+
+protected:
+	virtual void doserialize(std::ostream& stream, uint16_t protocolVersion) const
+	{
+		writeVal(stream, bufferMs);
+		writeVal(stream, medianAgeMs);
+		writeVal(stream, syncErrorUs);
+		writeVal(stream, xruns);
+		writeVal(stream, resyncs);
+		writeVal(stream, decodeUs);
+		writeVal(stream, maxDecodeUs);
+		writeVal(stream, rttUs);
+	}
+};
+
+}
+
+
+#endif
+
+
@@ -56,7 +56,7 @@ public:
 	std::string codec;
 
 protected:
-	virtual void doserialize(std::ostream& stream) const
+	virtual void doserialize(std::ostream& stream, uint16_t protocolVersion) const
 	{
 		writeVal(stream, codec);
 		writeVal(stream, payload, payloadSize);
@@ -42,7 +42,8 @@ public:
 		msg["ClientName"] = "Snapclient";
 		msg["OS"] = ::getOS();
 		msg["Arch"] = ::getArch();
-		msg["SnapStreamProtocolVersion"] = 2;
+		msg["SnapStreamProtocolVersion"] = msg::protocolVersion;
+		msg["Multicast"] = true;
 	}
 
 	virtual ~Hello()
@@ -84,6 +85,28 @@ public:
 		return get("SnapStreamProtocolVersion", 1);
 	}
 
+	/// Client can receive chunks via multicast (see ServerSettings::getMulticast)
+	bool supportsMulticast()
+	{
+		return get("Multicast", false);
+	}
+
+	void setMulticast(bool multicast)
+	{
+		msg["Multicast"] = multicast;
+	}
+
+	/// UDP port the client receives chunks on (see ServerSettings::isUdp), 0: TCP only
+	uint16_t getUdpPort()
+	{
+		return get("UdpPort", 0);
+	}
+
+	void setUdpPort(uint16_t port)
+	{
+		msg["UdpPort"] = port;
+	}
+
 };
 
 }
@@ -0,0 +1,97 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef JITTER_REPORT_H
+#define JITTER_REPORT_H
+
+#include "jsonMessage.h"
+
+
+namespace msg
+{
+
+/// Client to server: network jitter as measured by the client
+/**
+ * The arrival age of a chunk is the server time of arrival minus the chunk's timestamp.
+ * "requiredBufferMs" is the server buffer this client needs to play every chunk of the
+ * measurement window in time: max. arrival age + output delay + client latency + safety margin
+ */
+class JitterReport : public JsonMessage
+{
+public:
+	JitterReport() : JsonMessage(message_type::kJitterReport)
+	{
+		setArrivalAge(0, 0, 0);
+		setLateChunks(0);
+		setRequiredBufferMs(0);
+	}
+
+	virtual ~JitterReport()
+	{
+	}
+
+	int32_t getMedianAgeMs()
+	{
+		return get("medianAgeMs", 0);
+	}
+
+	int32_t getP99AgeMs()
+	{
+		return get("p99AgeMs", 0);
+	}
+
+	int32_t getMaxAgeMs()
+	{
+		return get("maxAgeMs", 0);
+	}
+
+	uint32_t getLateChunks()
+	{
+		return get("lateChunks", 0);
+	}
+
+	int32_t getRequiredBufferMs()
+	{
+		return get("requiredBufferMs", 0);
+	}
+
+
+
+	void setArrivalAge(int32_t medianMs, int32_t p99Ms, int32_t maxMs)
+	{
+		msg["medianAgeMs"] = medianMs;
+		msg["p99AgeMs"] = p99Ms;
+		msg["maxAgeMs"] = maxMs;
+	}
+
+	/// Chunks that arrived too late to be played within the measurement window
+	void setLateChunks(uint32_t lateChunks)
+	{
+		msg["lateChunks"] = lateChunks;
+	}
+
+	void setRequiredBufferMs(int32_t requiredBufferMs)
+	{
+		msg["requiredBufferMs"] = requiredBufferMs;
+	}
+};
+
+}
+
+
+#endif
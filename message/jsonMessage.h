@@ -56,7 +56,7 @@ public:
 
 
 protected:
-	virtual void doserialize(std::ostream& stream) const
+	virtual void doserialize(std::ostream& stream, uint16_t protocolVersion) const
 	{
 		writeVal(stream, msg.dump());
 	}
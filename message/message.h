@@ -26,6 +26,7 @@
 #include <vector>
 #include <sys/time.h>
 #include "common/endian.h"
+#include "common/timeDefs.h"
 
 
 template<typename CharT, typename TraitsT = std::char_traits<CharT> >
@@ -55,50 +56,68 @@ enum message_type
 	kWireChunk = 2,
 	kServerSettings = 3,
 	kTime = 4,
-	kHello = 5
+	kHello = 5,
+	kJitterReport = 6,
+	kChunkRequest = 7,
+	kWireChunkBatch = 8,
+	kClientStats = 9
 };
 
 
 
+/// Timestamp or duration [ns]. Timestamps are taken from chronos::clk (monotonic)
+/**
+ * Protocol version 2 transfers it as int32 sec and usec, version 3 and later as int64 nanoseconds.
+ * Version 2 peers take their timestamps from the system clock, they are translated on (de)serialization
+ */
 struct tv
 {
-	tv()
+	tv() : nsec(std::chrono::duration_cast<chronos::nsec>(chronos::clk::now().time_since_epoch()).count())
+	{
+	}
+	explicit tv(const chronos::time_point_clk& timePoint) : nsec(std::chrono::duration_cast<chronos::nsec>(timePoint.time_since_epoch()).count())
+	{
+	}
+	explicit tv(int64_t _nsec) : nsec(_nsec)
+	{
+	}
+	tv(int32_t sec, int32_t usec) : nsec(sec * 1000000000ll + usec * 1000ll)
 	{
-		timeval t;
-		gettimeofday(&t, NULL);
-		sec = t.tv_sec;
-		usec = t.tv_usec;
 	}
-	tv(timeval tv) : sec(tv.tv_sec), usec(tv.tv_usec) {};
-	tv(int32_t _sec, int32_t _usec) : sec(_sec), usec(_usec) {};
 
-	int32_t sec;
-	int32_t usec;
+	int64_t nsec;
+
+	chronos::time_point_clk toTimePoint() const
+	{
+		return chronos::time_point_clk(std::chrono::duration_cast<chronos::clk::duration>(chronos::nsec(nsec)));
+	}
+
+	/// whole seconds, rounded down (i.e. usec is always positive)
+	int32_t sec() const
+	{
+		return (nsec >= 0) ? nsec / 1000000000ll : -((-nsec + 999999999ll) / 1000000000ll);
+	}
+
+	int32_t usec() const
+	{
+		return (nsec - sec() * 1000000000ll) / 1000;
+	}
+
+	/// system clock - chronos::clk [ns]
+	static int64_t systemClockOffset()
+	{
+		return std::chrono::duration_cast<chronos::nsec>(std::chrono::system_clock::now().time_since_epoch()).count() -
+			std::chrono::duration_cast<chronos::nsec>(chronos::clk::now().time_since_epoch()).count();
+	}
 
 	tv operator+(const tv& other) const
 	{
-		tv result(*this);
-		result.sec += other.sec;
-		result.usec += other.usec;
-		if (result.usec > 1000000)
-		{
-			result.sec += result.usec / 1000000;
-			result.usec %= 1000000;
-		}
-		return result;
+		return tv(nsec + other.nsec);
 	}
 
 	tv operator-(const tv& other) const
 	{
-		tv result(*this);
-		result.sec -= other.sec;
-		result.usec -= other.usec;
-		while (result.usec < 0)
-		{
-			result.sec -= 1;
-			result.usec += 1000000;
-		}
-		return result;
+		return tv(nsec - other.nsec);
 	}
 };
 
@@ -107,13 +126,32 @@ namespace msg
 
 const size_t max_size = 1000000;
 
+/// Protocol version of this build, announced in the Hello. Until the ServerSettings
+/// confirm it, messages are exchanged with version 2. Datagrams always use this version
+/// 3: int64 nanosecond timestamps, 4: WireChunkBatch, 5: ClientStats
+const uint16_t protocolVersion = 5;
+
+/// Payload that is referenced instead of copied by the scattered serialization
+struct PayloadRef
+{
+	PayloadRef(std::streamoff _offset, const char* _data, uint32_t _size) : offset(_offset), data(_data), size(_size)
+	{
+	}
+
+	/// position of the payload in the serialized message, i.e. in the stream without payloads
+	std::streamoff offset;
+	const char* data;
+	uint32_t size;
+};
+
+
 struct BaseMessage
 {
-	BaseMessage() : type(kBase), id(0), refersTo(0)
+	BaseMessage() : type(kBase), id(0), refersTo(0), version(2)
 	{
 	}
 
-	BaseMessage(message_type type_) : type(type_), id(0), refersTo(0)
+	BaseMessage(message_type type_) : type(type_), id(0), refersTo(0), version(2)
 	{
 	}
 
@@ -126,15 +164,14 @@ struct BaseMessage
 		readVal(stream, type);
 		readVal(stream, id);
 		readVal(stream, refersTo);
-		readVal(stream, sent.sec);
-		readVal(stream, sent.usec);
-		readVal(stream, received.sec);
-		readVal(stream, received.usec);
+		readVal(stream, sent);
+		readVal(stream, received);
 		readVal(stream, size);
 	}
 
-	void deserialize(char* payload)
+	void deserialize(char* payload, uint16_t protocolVersion = 2)
 	{
+		version = protocolVersion;
 		membuf databuf(payload, payload + BaseMessage::getSize());
 		std::istream is(&databuf);
 		read(is);
@@ -148,23 +185,24 @@ struct BaseMessage
 		sent = baseMessage.sent;
 		received = baseMessage.received;
 		size = baseMessage.size;
+		version = baseMessage.version;
 		membuf databuf(payload, payload + size);
 		std::istream is(&databuf);
 		read(is);
 	}
 
-	virtual void serialize(std::ostream& stream) const
+	virtual void serialize(std::ostream& stream, uint16_t protocolVersion = 2) const
 	{
-		writeVal(stream, type);
-		writeVal(stream, id);
-		writeVal(stream, refersTo);
-		writeVal(stream, sent.sec);
-		writeVal(stream, sent.usec);
-		writeVal(stream, received.sec);
-		writeVal(stream, received.usec);
-		size = getSize();
-		writeVal(stream, size);
-		doserialize(stream);
+		writeHeader(stream, protocolVersion);
+		doserialize(stream, protocolVersion);
+	}
+
+	/// Like serialize, but payloads are not written to the stream. They are referenced in "payloads"
+	/// and must stay valid until sent. The stream must support tellp
+	void serialize(std::ostream& stream, std::vector<PayloadRef>& payloads, uint16_t protocolVersion) const
+	{
+		writeHeader(stream, protocolVersion);
+		doserializeScattered(stream, payloads, protocolVersion);
 	}
 
 	virtual uint32_t getSize() const
@@ -178,8 +216,21 @@ struct BaseMessage
 	tv received;
 	mutable tv sent;
 	mutable uint32_t size;
+	/// protocol version the message was deserialized with (not transferred)
+	uint16_t version;
 
 protected:
+	void writeHeader(std::ostream& stream, uint16_t protocolVersion) const
+	{
+		writeVal(stream, type);
+		writeVal(stream, id);
+		writeVal(stream, refersTo);
+		writeVal(stream, sent, protocolVersion);
+		writeVal(stream, received, protocolVersion);
+		size = getSize();
+		writeVal(stream, size);
+	}
+
 	void writeVal(std::ostream& stream, const bool& val) const
 	{
 		char c = val?1:0;
@@ -215,6 +266,32 @@ protected:
 		stream.write(reinterpret_cast<const char*>(&v), sizeof(int32_t));
 	}
 
+	void writeVal(std::ostream& stream, const int64_t& val) const
+	{
+		uint64_t v = SWAP_64(val);
+		stream.write(reinterpret_cast<const char*>(&v), sizeof(int64_t));
+	}
+
+	/// timestamp, version 2 peers expect it in system clock time
+	void writeVal(std::ostream& stream, const tv& val, uint16_t protocolVersion) const
+	{
+		if (protocolVersion >= 3)
+			writeDuration(stream, val, protocolVersion);
+		else
+			writeDuration(stream, tv(val.nsec + tv::systemClockOffset()), protocolVersion);
+	}
+
+	void writeDuration(std::ostream& stream, const tv& val, uint16_t protocolVersion) const
+	{
+		if (protocolVersion >= 3)
+		{
+			writeVal(stream, val.nsec);
+			return;
+		}
+		writeVal(stream, val.sec());
+		writeVal(stream, val.usec());
+	}
+
 	void writeVal(std::ostream& stream, const char* payload, const uint32_t& size) const
 	{
 		writeVal(stream, size);
@@ -265,6 +342,33 @@ protected:
 		val = SWAP_32(val);
 	}
 
+	void readVal(std::istream& stream, int64_t& val) const
+	{
+		stream.read(reinterpret_cast<char*>(&val), sizeof(int64_t));
+		val = SWAP_64(val);
+	}
+
+	/// timestamp in the format of the message's protocol version
+	void readVal(std::istream& stream, tv& val) const
+	{
+		readDuration(stream, val);
+		if (version < 3)
+			val.nsec -= tv::systemClockOffset();
+	}
+
+	void readDuration(std::istream& stream, tv& val) const
+	{
+		if (version >= 3)
+		{
+			readVal(stream, val.nsec);
+			return;
+		}
+		int32_t sec, usec;
+		readVal(stream, sec);
+		readVal(stream, usec);
+		val = tv(sec, usec);
+	}
+
 	void readVal(std::istream& stream, char** payload, uint32_t& size) const
 	{
 		readVal(stream, size);
@@ -281,8 +385,21 @@ protected:
 	}
 
 
-	virtual void doserialize(std::ostream& stream) const
+	/// Writes the size and references the payload
+	void writeRef(std::ostream& stream, std::vector<PayloadRef>& payloads, const char* payload, const uint32_t& size) const
+	{
+		writeVal(stream, size);
+		payloads.push_back(PayloadRef(stream.tellp(), payload, size));
+	}
+
+	virtual void doserialize(std::ostream& stream, uint16_t protocolVersion) const
+	{
+	};
+
+	/// Messages with large payloads reference them with writeRef
+	virtual void doserializeScattered(std::ostream& stream, std::vector<PayloadRef>& payloads, uint16_t protocolVersion) const
 	{
+		doserialize(stream, protocolVersion);
 	};
 };
 
@@ -37,6 +37,11 @@ PcmChunk::PcmChunk(const PcmChunk& pcmChunk) : WireChunk(pcmChunk), format(pcmCh
 }
 
 
+PcmChunk::PcmChunk(const SampleFormat& sampleFormat, const WireChunk& wireChunk) : WireChunk(wireChunk), format(sampleFormat), idx_(0)
+{
+}
+
+
 PcmChunk::PcmChunk() : WireChunk(), idx_(0)
 {
 }
@@ -38,6 +38,7 @@ class PcmChunk : public WireChunk
 public:
 	PcmChunk(const SampleFormat& sampleFormat, size_t ms);
 	PcmChunk(const PcmChunk& pcmChunk);
+	PcmChunk(const SampleFormat& sampleFormat, const WireChunk& wireChunk);
 	PcmChunk();
 	virtual ~PcmChunk();
 
@@ -46,11 +47,7 @@ public:
 
 	virtual chronos::time_point_clk start() const
 	{
-		return chronos::time_point_clk(
-				chronos::sec(timestamp.sec) +
-				chronos::usec(timestamp.usec) +
-				chronos::usec((chronos::usec::rep)(1000000. * ((double)idx_ / (double)format.rate)))
-				);
+		return tv(timestamp.nsec + (int64_t)idx_ * 1000000000ll / format.rate).toTimePoint();
 	}
 
 	inline chronos::time_point_clk end() const
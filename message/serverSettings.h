@@ -60,6 +60,37 @@ public:
 		return get("muted", false);
 	}
 
+	/// The buffer was lowered or raised by the server's adaptation (see JitterReport),
+	/// the client moves there gradually instead of resyncing
+	bool isAdaptive()
+	{
+		return get("adaptive", false);
+	}
+
+	/// "group:port" the client receives the chunks from, empty: chunks are sent on this connection
+	std::string getMulticast()
+	{
+		return get("multicast", std::string(""));
+	}
+
+	/// Chunks are sent to the client's UDP port (see Hello::getUdpPort)
+	bool isUdp()
+	{
+		return get("udp", false);
+	}
+
+	/// Protocol version used for all following messages on the connection (see msg::protocolVersion)
+	uint16_t getProtocolVersion()
+	{
+		return get("protocolVersion", 2);
+	}
+
+	/// UDP port of the server's time sync responder, 0: time sync on this connection
+	uint16_t getTimeSyncPort()
+	{
+		return get("timeSyncPort", 0);
+	}
+
 
 
 	void setBufferMs(int32_t bufferMs)
@@ -81,6 +112,31 @@ public:
 	{
 		msg["muted"] = muted;
 	}
+
+	void setAdaptive(bool adaptive)
+	{
+		msg["adaptive"] = adaptive;
+	}
+
+	void setMulticast(const std::string& endpoint)
+	{
+		msg["multicast"] = endpoint;
+	}
+
+	void setUdp(bool udp)
+	{
+		msg["udp"] = udp;
+	}
+
+	void setProtocolVersion(uint16_t version)
+	{
+		msg["protocolVersion"] = version;
+	}
+
+	void setTimeSyncPort(uint16_t port)
+	{
+		msg["timeSyncPort"] = port;
+	}
 };
 
 }
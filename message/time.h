@@ -37,8 +37,7 @@ public:
 
 	virtual void read(std::istream& stream)
 	{
-		readVal(stream, latency.sec);
-		readVal(stream, latency.usec);
+		readDuration(stream, latency);
 	}
 
 	virtual uint32_t getSize() const
@@ -49,10 +48,9 @@ public:
 	tv latency;
 
 protected:
-	virtual void doserialize(std::ostream& stream) const
+	virtual void doserialize(std::ostream& stream, uint16_t protocolVersion) const
 	{
-		writeVal(stream, latency.sec);
-		writeVal(stream, latency.usec);
+		writeDuration(stream, latency, protocolVersion);
 	}
 };
 
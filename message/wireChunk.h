@@ -57,8 +57,7 @@ public:
 
 	virtual void read(std::istream& stream)
 	{
-		readVal(stream, timestamp.sec);
-		readVal(stream, timestamp.usec);
+		readVal(stream, timestamp);
 		readVal(stream, &payload, payloadSize);
 	}
 
@@ -69,7 +68,7 @@ public:
 
 	virtual chronos::time_point_clk start() const
 	{
-		return chronos::time_point_clk(chronos::sec(timestamp.sec) + chronos::usec(timestamp.usec));
+		return timestamp.toTimePoint();
 	}
 
 	tv timestamp;
@@ -77,12 +76,17 @@ public:
 	char* payload;
 
 protected:
-	virtual void doserialize(std::ostream& stream) const
+	virtual void doserialize(std::ostream& stream, uint16_t protocolVersion) const
 	{
-		writeVal(stream, timestamp.sec);
-		writeVal(stream, timestamp.usec);
+		writeVal(stream, timestamp, protocolVersion);
 		writeVal(stream, payload, payloadSize);
 	}
+
+	virtual void doserializeScattered(std::ostream& stream, std::vector<PayloadRef>& payloads, uint16_t protocolVersion) const
+	{
+		writeVal(stream, timestamp, protocolVersion);
+		writeRef(stream, payloads, payload, payloadSize);
+	}
 };
 
 }
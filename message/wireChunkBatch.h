@@ -0,0 +1,126 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef WIRE_CHUNK_BATCH_H
+#define WIRE_CHUNK_BATCH_H
+
+#include <limits>
+#include <memory>
+#include <vector>
+#include "wireChunk.h"
+
+
+namespace msg
+{
+
+/**
+ * Consecutive WireChunks in one message
+ * The first timestamp is transferred in full, the following ones as int32 [ns] difference
+ * to the previous chunk. Per chunk this takes 8 bytes instead of the 26 byte BaseMessage
+ * and 12 byte WireChunk headers. Requires protocol version 4
+ */
+class WireChunkBatch : public BaseMessage
+{
+public:
+	WireChunkBatch() : BaseMessage(message_type::kWireChunkBatch)
+	{
+	}
+
+	virtual ~WireChunkBatch()
+	{
+	}
+
+	/// Appends a chunk, false if it doesn't fit (too large, or the timestamp difference exceeds int32)
+	bool add(const std::shared_ptr<const WireChunk>& chunk)
+	{
+		if (chunks.size() >= std::numeric_limits<uint16_t>::max())
+			return false;
+		if (getSize() + sizeof(int32_t) + sizeof(uint32_t) + chunk->payloadSize > max_size)
+			return false;
+		if (!chunks.empty())
+		{
+			int64_t delta = chunk->timestamp.nsec - chunks.back()->timestamp.nsec;
+			if ((delta > std::numeric_limits<int32_t>::max()) || (delta < std::numeric_limits<int32_t>::min()))
+				return false;
+		}
+		chunks.push_back(chunk);
+		return true;
+	}
+
+	virtual void read(std::istream& stream)
+	{
+		chunks.clear();
+		uint16_t count;
+		readVal(stream, count);
+		tv timestamp;
+		readVal(stream, timestamp);
+		for (uint16_t n=0; n<count; ++n)
+		{
+			int32_t delta;
+			readVal(stream, delta);
+			timestamp.nsec += delta;
+			std::shared_ptr<WireChunk> chunk = std::make_shared<WireChunk>();
+			chunk->timestamp = timestamp;
+			readVal(stream, &chunk->payload, chunk->payloadSize);
+			chunks.push_back(chunk);
+		}
+	}
+
+	virtual uint32_t getSize() const
+	{
+		uint32_t size = sizeof(uint16_t) + sizeof(tv);
+		for (const auto& chunk: chunks)
+			size += sizeof(int32_t) + sizeof(uint32_t) + chunk->payloadSize;
+		return size;
+	}
+
+	std::vector<std::shared_ptr<const WireChunk>> chunks;
+
+protected:
+	virtual void doserialize(std::ostream& stream, uint16_t protocolVersion) const
+	{
+		serializeChunks(stream, protocolVersion, NULL);
+	}
+
+	virtual void doserializeScattered(std::ostream& stream, std::vector<PayloadRef>& payloads, uint16_t protocolVersion) const
+	{
+		serializeChunks(stream, protocolVersion, &payloads);
+	}
+
+	/// payloads: NULL to write the payloads
+	void serializeChunks(std::ostream& stream, uint16_t protocolVersion, std::vector<PayloadRef>* payloads) const
+	{
+		writeVal(stream, (uint16_t)chunks.size());
+		tv timestamp = chunks.empty() ? tv(0) : chunks.front()->timestamp;
+		writeVal(stream, timestamp, protocolVersion);
+		for (const auto& chunk: chunks)
+		{
+			writeVal(stream, (int32_t)(chunk->timestamp.nsec - timestamp.nsec));
+			timestamp = chunk->timestamp;
+			if (payloads != NULL)
+				writeRef(stream, *payloads, chunk->payload, chunk->payloadSize);
+			else
+				writeVal(stream, chunk->payload, chunk->payloadSize);
+		}
+	}
+};
+
+}
+
+
+#endif
@@ -0,0 +1,107 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sstream>
+#include "datagramSender.h"
+#include "common/log.h"
+#include "common/strCompat.h"
+
+using namespace std;
+
+static const size_t historySize = datagram::chunkWindow;
+
+
+DatagramSender::DatagramSender(asio::io_service* ioService, const udp::endpoint& endpoint, uint8_t fecGroup) :
+	socket_(*ioService), endpoint_(endpoint), encoder_(fecGroup), chunkSeq_(0)
+{
+	socket_.open(endpoint_.protocol());
+	if (isMulticast())
+	{
+		socket_.set_option(asio::ip::multicast::hops(1));
+		socket_.set_option(asio::ip::multicast::enable_loopback(true));
+	}
+}
+
+
+void DatagramSender::send(const std::shared_ptr<const msg::BaseMessage>& chunk)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	/// unicast senders share the chunk with other sessions, the datagram header carries the number
+	if (isMulticast())
+		chunk->id = chunkSeq_ & 0xffff;
+	sendTo(chunkSeq_, *chunk);
+
+	history_.push_back(chunk);
+	if (history_.size() > historySize)
+		history_.pop_front();
+	++chunkSeq_;
+}
+
+
+bool DatagramSender::resend(uint32_t chunkSeq)
+{
+	std::shared_ptr<const msg::BaseMessage> chunk = getChunk(chunkSeq);
+	if (!chunk)
+		return false;
+	std::lock_guard<std::mutex> lock(mutex_);
+	sendTo(chunkSeq, *chunk);
+	return true;
+}
+
+
+void DatagramSender::sendTo(uint32_t chunkSeq, const msg::BaseMessage& chunk)
+{
+	chunk.sent = tv();
+	std::ostringstream stream;
+	chunk.serialize(stream, msg::protocolVersion);
+	string data = stream.str();
+
+	try
+	{
+		for (const auto& datagram: encoder_.encode(chunkSeq, data.data(), data.size()))
+			socket_.send_to(asio::buffer(datagram), endpoint_);
+	}
+	catch (const std::exception& e)
+	{
+		logE << "Datagram send to " << getEndpoint() << " failed: " << e.what() << "\n";
+	}
+}
+
+
+std::shared_ptr<const msg::BaseMessage> DatagramSender::getChunk(uint32_t chunkSeq) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	/// history_ holds the chunks chunkSeq_ - size .. chunkSeq_ - 1
+	uint32_t age = chunkSeq_ - chunkSeq;
+	if ((age == 0) || (age > history_.size()))
+		return nullptr;
+	return history_[history_.size() - age];
+}
+
+
+bool DatagramSender::isMulticast() const
+{
+	return endpoint_.address().is_multicast();
+}
+
+
+std::string DatagramSender::getEndpoint() const
+{
+	return endpoint_.address().to_string() + ":" + cpt::to_string(endpoint_.port());
+}
+
@@ -0,0 +1,68 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef DATAGRAM_SENDER_H
+#define DATAGRAM_SENDER_H
+
+#include <asio.hpp>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "message/message.h"
+#include "common/chunkDatagram.h"
+
+
+using asio::ip::udp;
+
+
+/// Sends numbered chunks as datagrams to a multicast group or to a single client
+/**
+ * Chunks are numbered, split into datagrams and protected with XOR parity (see DatagramEncoder).
+ * The last chunks are kept to resend them on request (msg::ChunkRequest).
+ * Multicast: the chunk's id is set to the lower 16 bits of its number, repairs are sent over
+ * the client's connection. Unicast: repairs are resent as datagrams with their original number
+ */
+class DatagramSender
+{
+public:
+	DatagramSender(asio::io_service* ioService, const udp::endpoint& endpoint, uint8_t fecGroup);
+
+	void send(const std::shared_ptr<const msg::BaseMessage>& chunk);
+	/// A recently sent chunk, nullptr if not available anymore
+	std::shared_ptr<const msg::BaseMessage> getChunk(uint32_t chunkSeq) const;
+	/// Sends a recently sent chunk again, false if not available anymore
+	bool resend(uint32_t chunkSeq);
+
+	bool isMulticast() const;
+	/// "address:port"
+	std::string getEndpoint() const;
+
+private:
+	void sendTo(uint32_t chunkSeq, const msg::BaseMessage& chunk);
+
+	udp::socket socket_;
+	udp::endpoint endpoint_;
+	mutable std::mutex mutex_;
+	DatagramEncoder encoder_;
+	uint32_t chunkSeq_;
+	std::deque<std::shared_ptr<const msg::BaseMessage>> history_;
+};
+
+
+#endif
@@ -0,0 +1,150 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <algorithm>
+#include "common/endian.h"
+#include "common/deltaCodec.h"
+#include "common/snapException.h"
+#include "common/strCompat.h"
+#include "deltaEncoder.h"
+
+
+DeltaEncoder::DeltaEncoder(const std::string& codecOptions) : PcmEncoder(codecOptions), residuals1_(delta::blockFrames), residuals2_(delta::blockFrames)
+{
+	headerChunk_->codec = "delta";
+}
+
+
+void DeltaEncoder::encode(const msg::PcmChunk* chunk)
+{
+	size_t frames = chunk->getFrameCount();
+	size_t channels = sampleFormat_.channels;
+	size_t blocks = (frames + delta::blockFrames - 1) / delta::blockFrames;
+	/// worst case: order 2 residuals need 2 bits more than the sample, zigzag one more
+	size_t maxWidth = 8 * sampleFormat_.sampleSize + 3;
+	size_t maxSize = sizeof(uint32_t) * (1 + channels) + blocks * channels * (1 + (delta::blockFrames * maxWidth + 7) / 8);
+
+	msg::PcmChunk* deltaChunk = new msg::PcmChunk(sampleFormat_, 0);
+	deltaChunk->timestamp = chunk->timestamp;
+	deltaChunk->payload = (char*)realloc(deltaChunk->payload, maxSize);
+
+	size_t size;
+	if (sampleFormat_.sampleSize == 1)
+		size = encodeSamples<int8_t>(chunk, deltaChunk->payload);
+	else if (sampleFormat_.sampleSize == 2)
+		size = encodeSamples<int16_t>(chunk, deltaChunk->payload);
+	else if (sampleFormat_.sampleSize == 4)
+		size = encodeSamples<int32_t>(chunk, deltaChunk->payload);
+	else
+	{
+		delete deltaChunk;
+		throw SnapException("Unsupported sample size: " + cpt::to_string(sampleFormat_.sampleSize));
+	}
+
+	deltaChunk->payloadSize = size;
+	deltaChunk->payload = (char*)realloc(deltaChunk->payload, size);
+	listener_->onChunkEncoded(this, deltaChunk, chunk->getFrameCount() / sampleFormat_.msRate());
+}
+
+
+template<typename T>
+size_t DeltaEncoder::encodeSamples(const msg::PcmChunk* chunk, char* buffer)
+{
+	const T* samples = (const T*)chunk->payload;
+	uint32_t frames = chunk->getFrameCount();
+	uint16_t channels = sampleFormat_.channels;
+	uint8_t* out = (uint8_t*)buffer;
+
+	assign(out, SWAP_32(frames));
+	out += sizeof(uint32_t);
+	if (frames == 0)
+		return out - (uint8_t*)buffer;
+
+	for (uint16_t c = 0; c < channels; ++c)
+	{
+		assign(out, SWAP_32((int32_t)endian::swap<T>(samples[c])));
+		out += sizeof(int32_t);
+	}
+
+	/// prediction history, warmed up with the first sample
+	std::vector<int64_t> prev1(channels);
+	std::vector<int64_t> prev2(channels);
+	for (uint16_t c = 0; c < channels; ++c)
+		prev1[c] = prev2[c] = endian::swap<T>(samples[c]);
+
+	for (uint32_t blockStart = 0; blockStart < frames; blockStart += delta::blockFrames)
+	{
+		uint32_t n = std::min(delta::blockFrames, frames - blockStart);
+		for (uint16_t c = 0; c < channels; ++c)
+		{
+			const T* s = samples + (size_t)blockStart * channels + c;
+			int64_t p1 = prev1[c];
+			int64_t p2 = prev2[c];
+			uint64_t or1 = 0;
+			uint64_t or2 = 0;
+			for (uint32_t i = 0; i < n; ++i)
+			{
+				int64_t x = endian::swap<T>(s[(size_t)i * channels]);
+				residuals1_[i] = delta::zigzag(x - p1);
+				residuals2_[i] = delta::zigzag(x - 2*p1 + p2);
+				or1 |= residuals1_[i];
+				or2 |= residuals2_[i];
+				p2 = p1;
+				p1 = x;
+			}
+			prev1[c] = p1;
+			prev2[c] = p2;
+
+			/// the OR of all values has the same bit width as the largest value
+			uint8_t width1 = delta::bitWidth(or1);
+			uint8_t width2 = delta::bitWidth(or2);
+			uint8_t order = (width2 < width1) ? 2 : 1;
+			uint8_t width = (order == 2) ? width2 : width1;
+			const uint64_t* residuals = (order == 2) ? residuals2_.data() : residuals1_.data();
+			*out++ = (order << delta::orderShift) | width;
+			if (width == 0)
+				continue;
+
+			uint64_t acc = 0;
+			uint8_t bits = 0;
+			for (uint32_t i = 0; i < n; ++i)
+			{
+				acc |= residuals[i] << bits;
+				bits += width;
+				while (bits >= 8)
+				{
+					*out++ = (uint8_t)acc;
+					acc >>= 8;
+					bits -= 8;
+				}
+			}
+			if (bits > 0)
+				*out++ = (uint8_t)acc;
+		}
+	}
+
+	return out - (uint8_t*)buffer;
+}
+
+
+std::string DeltaEncoder::name() const
+{
+	return "delta";
+}
+
+
@@ -0,0 +1,50 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef DELTA_ENCODER_H
+#define DELTA_ENCODER_H
+#include <vector>
+#include "pcmEncoder.h"
+
+
+/// Lossless "delta" encoder
+/**
+ * Cheap lossless compression for LAN setups with low-end clients.
+ * Each block of every channel is predicted with a fixed order 1 or 2
+ * predictor, the residuals are zigzag coded and bit packed.
+ * The stream header is the PCM RIFF header, see common/deltaCodec.h for the chunk layout.
+ */
+class DeltaEncoder : public PcmEncoder
+{
+public:
+	DeltaEncoder(const std::string& codecOptions = "");
+	virtual void encode(const msg::PcmChunk* chunk);
+	virtual std::string name() const;
+
+protected:
+	template<typename T>
+	size_t encodeSamples(const msg::PcmChunk* chunk, char* buffer);
+
+	std::vector<uint64_t> residuals1_;
+	std::vector<uint64_t> residuals2_;
+};
+
+
+#endif
+
+
@@ -18,6 +18,7 @@
 
 #include "encoderFactory.h"
 #include "pcmEncoder.h"
+#include "deltaEncoder.h"
 #include "oggEncoder.h"
 #include "flacEncoder.h"
 #include "common/utils.h"
@@ -44,6 +45,8 @@ Encoder* EncoderFactory::createEncoder(const std::string& codecSettings) const
 		encoder = new PcmEncoder(codecOptions);
 	else if (codec == "flac")
 		encoder = new FlacEncoder(codecOptions);
+	else if (codec == "delta")
+		encoder = new DeltaEncoder(codecOptions);
 	else
 	{
 		throw SnapException("unknown codec: " + codec);
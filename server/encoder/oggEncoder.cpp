@@ -28,14 +28,14 @@
 using namespace std;
 
 
-OggEncoder::OggEncoder(const std::string& codecOptions) : Encoder(codecOptions), lastGranulepos_(0)
+OggEncoder::OggEncoder(const std::string& codecOptions) : Encoder(codecOptions), lastGranulepos_(0), pageGranulepos_(0), cadenceFrames_(0)
 {
 }
 
 
 std::string OggEncoder::getAvailableOptions() const
 {
-	return "VBR:[-0.1 - 1.0]";
+	return "VBR:[-0.1 - 1.0][:PAGE_MS], PAGE_MS: emit a chunk as soon as at least PAGE_MS of audio are encoded (default: as soon as a page is ready)";
 }
 
 
@@ -53,7 +53,6 @@ std::string OggEncoder::name() const
 
 void OggEncoder::encode(const msg::PcmChunk* chunk)
 {
-	double res = 0;
 	logD << "payload: " << chunk->payloadSize << "\tframes: " << chunk->getFrameCount() << "\tduration: " << chunk->duration<chronos::msec>().count() << "\n";
 	int frames = chunk->getFrameCount();
 	float **buffer=vorbis_analysis_buffer(&vd_, frames);
@@ -84,12 +83,12 @@ void OggEncoder::encode(const msg::PcmChunk* chunk)
 	/* tell the library how much we actually submitted */
 	vorbis_analysis_wrote(&vd_, frames);
 
-	msg::PcmChunk* oggChunk = new msg::PcmChunk(chunk->format, 0);
+	if (!oggChunk_)
+		oggChunk_.reset(new msg::PcmChunk(chunk->format, 0));
 
 	/* vorbis does some data preanalysis, then divvies up blocks for
 	more involved (potentially parallel) processing.  Get a single
 	block for encoding now */
-	size_t pos = 0;
 	while (vorbis_analysis_blockout(&vd_, &vb_)==1)
 	{
 		/* analysis, assume we want to use bitrate management */
@@ -107,17 +106,17 @@ void OggEncoder::encode(const msg::PcmChunk* chunk)
 				int result = ogg_stream_flush(&os_, &og_);
 				if (result == 0)
 					break;
-				res = os_.granulepos - lastGranulepos_;
+				if (ogg_page_granulepos(&og_) >= 0)
+					pageGranulepos_ = ogg_page_granulepos(&og_);
 
-				size_t nextLen = pos + og_.header_len + og_.body_len;
-				// make chunk larger
-				if (oggChunk->payloadSize < nextLen)
-					oggChunk->payload = (char*)realloc(oggChunk->payload, nextLen);
+				/// pages without new granules are kept and sent with the next chunk
+				size_t pos = oggChunk_->payloadSize;
+				oggChunk_->payloadSize += og_.header_len + og_.body_len;
+				oggChunk_->payload = (char*)realloc(oggChunk_->payload, oggChunk_->payloadSize);
 
-				memcpy(oggChunk->payload + pos, og_.header, og_.header_len);
+				memcpy(oggChunk_->payload + pos, og_.header, og_.header_len);
 				pos += og_.header_len;
-				memcpy(oggChunk->payload + pos, og_.body, og_.body_len);
-				pos += og_.body_len;
+				memcpy(oggChunk_->payload + pos, og_.body, og_.body_len);
 
 				if (ogg_page_eos(&og_))
 					break;
@@ -125,18 +124,16 @@ void OggEncoder::encode(const msg::PcmChunk* chunk)
 		}
 	}
 
-	if (res > 0)
+	/// The granule position is the number of PCM frames encoded so far,
+	/// i.e. the duration of the chunk is exactly the granule delta
+	ogg_int64_t encodedFrames = pageGranulepos_ - lastGranulepos_;
+	if ((oggChunk_->payloadSize > 0) && (encodedFrames > 0) && (encodedFrames >= cadenceFrames_))
 	{
-		res /= (sampleFormat_.rate / 1000.);
-		// logO << "res: " << res << "\n";
-		lastGranulepos_ = os_.granulepos;
-		// make oggChunk smaller
-		oggChunk->payload = (char*)realloc(oggChunk->payload, pos);
-		oggChunk->payloadSize = pos;
-		listener_->onChunkEncoded(this, oggChunk, res);
+		double duration = (double)encodedFrames / sampleFormat_.msRate();
+		// logO << "duration: " << duration << "\n";
+		lastGranulepos_ = pageGranulepos_;
+		listener_->onChunkEncoded(this, oggChunk_.release(), duration);
 	}
-	else
-		delete oggChunk;
 }
 
 
@@ -149,10 +146,19 @@ void OggEncoder::initEncoder()
 		throw SnapException("Unsupported codec mode: \"" + mode + "\". Available: \"VBR\"");
 
 	string qual = trim_copy(codecOptions_.substr(codecOptions_.find(":") + 1));
+	string cadence;
+	if (qual.find(":") != string::npos)
+	{
+		cadence = trim_copy(qual.substr(qual.find(":") + 1));
+		qual = trim_copy(qual.substr(0, qual.find(":")));
+	}
 	double quality = 1.0;
+	double cadenceMs = 0.;
 	try
 	{
 		quality = cpt::stod(qual);
+		if (!cadence.empty())
+			cadenceMs = cpt::stod(cadence);
 	}
 	catch(...)
 	{
@@ -162,6 +168,11 @@ void OggEncoder::initEncoder()
 	{
 		throw SnapException("compression level has to be between -0.1 and 1.0");
 	}
+	if (cadenceMs < 0.)
+	{
+		throw SnapException("page cadence must not be negative");
+	}
+	cadenceFrames_ = (ogg_int64_t)(cadenceMs * sampleFormat_.msRate());
 
 	/********** Encode setup ************/
 	vorbis_info_init(&vi_);
@@ -45,7 +45,10 @@ private:
 	vorbis_dsp_state vd_; /// central working state for the packet->PCM decoder
 	vorbis_block     vb_; /// local working space for packet->PCM decode
 
-	ogg_int64_t   lastGranulepos_;
+	std::unique_ptr<msg::PcmChunk> oggChunk_; /// encoded pages that are not yet passed to the listener
+	ogg_int64_t   lastGranulepos_; /// granule position of the end of the last passed chunk
+	ogg_int64_t   pageGranulepos_; /// granule position of the last page
+	ogg_int64_t   cadenceFrames_;  /// minimum number of frames per chunk
 };
 
 
@@ -58,13 +58,17 @@ int main(int argc, char* argv[])
 		Switch versionSwitch("v", "version", "Show version number");
 		Value<size_t> portValue("p", "port", "Server port", settings.port, &settings.port);
 		Value<size_t> controlPortValue("", "controlPort", "Remote control port", settings.controlPort, &settings.controlPort);
-		Value<string> streamValue("s", "stream", "URI of the PCM input stream.\nFormat: TYPE://host/path?name=NAME\n[&codec=CODEC]\n[&sampleformat=SAMPLEFORMAT]", pcmStream, &pcmStream);
+		Value<string> streamValue("s", "stream", "URI of the PCM input stream.\nFormat: TYPE://host/path?name=NAME\n[&codec=CODEC]\n[&sampleformat=SAMPLEFORMAT]\n[&buffer=BUFFER_MS]\nRelay another server: snapcast://host[:port]/?name=NAME", pcmStream, &pcmStream);
 
 		Value<string> sampleFormatValue("", "sampleformat", "Default sample format", settings.sampleFormat);
-		Value<string> codecValue("c", "codec", "Default transport codec\n(flac|ogg|pcm)[:options]\nType codec:? to get codec specific options", settings.codec, &settings.codec);
+		Value<string> codecValue("c", "codec", "Default transport codec\n(flac|ogg|pcm|delta)[:options]\nType codec:? to get codec specific options", settings.codec, &settings.codec);
 		Value<size_t> streamBufferValue("", "streamBuffer", "Default stream read buffer [ms]", settings.streamReadMs, &settings.streamReadMs);
 
-		Value<int> bufferValue("b", "buffer", "Buffer [ms]", settings.bufferMs, &settings.bufferMs);
+		Value<int> bufferValue("b", "buffer", "Default buffer [ms] of the streams", settings.bufferMs, &settings.bufferMs);
+		Switch adaptiveBufferSwitch("", "adaptiveBuffer", "Adapt the buffer per stream to the clients' network jitter\n(the stream's buffer is the maximum)");
+		Value<string> multicastValue("", "multicast", "Publish the chunks to a multicast group\nFormat: GROUP:PORT, the n-th stream uses PORT+n", "", &settings.multicast);
+		Switch udpSwitch("", "udp", "Send the chunks to the clients via UDP, lost ones are resent on request");
+		Value<size_t> fecValue("", "fec", "Multicast/UDP: datagrams per XOR parity datagram (0: no FEC)", settings.fecGroup, &settings.fecGroup);
 		Implicit<int> daemonOption("d", "daemon", "Daemonize\noptional process priority [-20..19]", 0, &processPriority);
 
 		OptionParser op("Allowed options");
@@ -77,6 +81,10 @@ int main(int argc, char* argv[])
 		 .add(codecValue)
 		 .add(streamBufferValue)
 		 .add(bufferValue)
+		 .add(adaptiveBufferSwitch)
+		 .add(multicastValue)
+		 .add(udpSwitch)
+		 .add(fecValue)
 		 .add(daemonOption);
 
 		try
@@ -154,7 +162,13 @@ int main(int argc, char* argv[])
 
 		if (settings.bufferMs < 400)
 			settings.bufferMs = 400;
+		else if (settings.bufferMs > maxStreamBufferMs)
+			settings.bufferMs = maxStreamBufferMs;
 		settings.sampleFormat = sampleFormatValue.getValue();
+		settings.adaptiveBuffer = adaptiveBufferSwitch.isSet();
+		settings.udp = udpSwitch.isSet();
+		if (settings.fecGroup > 255)
+			settings.fecGroup = 255;
 
 		asio::io_service io_service;
 		std::unique_ptr<StreamServer> streamServer(new StreamServer(&io_service, settings));
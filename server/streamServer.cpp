@@ -20,7 +20,11 @@
 #include "streamServer.h"
 #include "message/time.h"
 #include "message/hello.h"
+#include "message/jitterReport.h"
+#include "message/chunkRequest.h"
 #include "common/log.h"
+#include "common/snapException.h"
+#include "common/strCompat.h"
 #include "config.h"
 #include <iostream>
 
@@ -28,6 +32,14 @@ using namespace std;
 
 using json = nlohmann::json;
 
+static const int32_t minAdaptiveBufferMs = 20;
+/// a repair must arrive and be decoded before the chunk is played
+static const int32_t minRepairLeadMs = 30;
+/// clients report every 5s: 10 minutes
+static const size_t clientStatsReports = 120;
+/// clients report (JitterReport) after 5s of playback. Without reports, the datagrams don't reach them
+static const long datagramTimeoutMs = 15000;
+
 
 StreamServer::StreamServer(asio::io_service* io_service, const StreamServerSettings& streamServerSettings) : io_service_(io_service), settings_(streamServerSettings)
 {
@@ -54,23 +66,75 @@ void StreamServer::onChunkRead(const PcmStream* pcmStream, const msg::PcmChunk*
 	bool isDefaultStream(pcmStream == streamManager_->getDefaultStream().get());
 
 	std::shared_ptr<const msg::BaseMessage> shared_message(chunk);
+	auto multicastSender = multicastSenders_.find(pcmStream);
+	bool multicast = (multicastSender != multicastSenders_.end());
+	if (multicast)
+		multicastSender->second->send(shared_message);
+
 	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
 	for (auto s : sessions_)
 	{
-		if (!s->pcmStream() && isDefaultStream)//->getName() == "default")
-			s->sendAsync(shared_message);
-		else if (s->pcmStream().get() == pcmStream)
-			s->sendAsync(shared_message);
+		if (!(!s->pcmStream() && isDefaultStream) && (s->pcmStream().get() != pcmStream))
+			continue;
+		if (((multicast && s->isMulticast()) || s->getDatagramSender()) && s->isDatagramLost(datagramTimeoutMs))
+			disableDatagrams(s);
+		if (multicast && s->isMulticast())
+			continue;
+		s->sendAsync(shared_message);
 	}
 }
 
 
+void StreamServer::disableDatagrams(const session_ptr& session)
+{
+	logE << "No JitterReports from " << session->macAddress << " for " << datagramTimeoutMs << "ms, sending the chunks via TCP\n";
+	session->setMulticast(false);
+	session->setDatagramSender(nullptr);
+	ClientInfoPtr client = Config::instance().getClientInfo(session->macAddress);
+	if (client == nullptr)
+		return;
+	msg::ServerSettings* serverSettings = new msg::ServerSettings();
+	setClientSettings(*serverSettings, client, session->pcmStream());
+	setTransport(*serverSettings, session.get());
+	session->sendAsync(serverSettings);
+}
+
+
 void StreamServer::onResync(const PcmStream* pcmStream, double ms)
 {
 	logO << "onResync (" << pcmStream->getName() << "): " << ms << "ms\n";
 }
 
 
+void StreamServer::onHeaderChanged(const PcmStream* pcmStream, const std::shared_ptr<msg::CodecHeader>& header)
+{
+	logO << "onHeaderChanged (" << pcmStream->getName() << "): " << header->codec << "\n";
+	bool isDefaultStream(pcmStream == streamManager_->getDefaultStream().get());
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	for (auto s : sessions_)
+	{
+		if ((!s->pcmStream() && isDefaultStream) || (s->pcmStream().get() == pcmStream))
+			s->sendAsync(header);
+	}
+}
+
+
+void StreamServer::onBufferChanged(const PcmStream* pcmStream, bool adaptive)
+{
+	logO << "onBufferChanged (" << pcmStream->getName() << "): " << pcmStream->getBufferMs() << "ms\n";
+	PcmStreamPtr stream = streamManager_->getStream(pcmStream->getId());
+	if (stream == nullptr)
+		return;
+	{
+		std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+		streamBuffers_.erase(stream.get());
+	}
+	sendBuffer(stream, adaptive);
+	json notification = JsonNotification::getJson("Stream.OnUpdate", stream->toJson());
+	controlServer_->send(notification.dump(), NULL);
+}
+
+
 void StreamServer::onDisconnect(StreamSession* streamSession)
 {
 	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
@@ -151,12 +215,48 @@ void StreamServer::onMessageReceived(ControlSession* controlSession, const std::
 			};
 //			cout << response.dump(4);
 		}
+		else if (request.method == "Server.GetStats")
+		{
+			response = {{"clients", getStatsSummary()}};
+		}
+		else if (request.method == "Client.GetStats")
+		{
+			string mac = request.getParam("client").get<string>();
+			if (Config::instance().getClientInfo(mac, false) == nullptr)
+				throw JsonInternalErrorException("Client not found", request.id);
+			response = {
+				{"client", mac},
+				{"stats", getClientStats(mac)}
+			};
+		}
+		else if (request.method == "Stream.SetBuffer")
+		{
+			PcmStreamPtr stream = streamManager_->getStream(request.getParam("id").get<string>());
+			if (stream == nullptr)
+				throw JsonInternalErrorException("Stream not found", request.id);
+			int32_t bufferMs = request.getParam<int>("buffer", minStreamBufferMs, maxStreamBufferMs);
+			logO << "Buffer of stream " << stream->getName() << " set to " << bufferMs << "ms\n";
+			stream->setBufferMs(bufferMs);
+			{
+				/// the adapted buffer starts over from the new maximum
+				std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+				streamBuffers_.erase(stream.get());
+			}
+			sendBuffer(stream);
+			response = stream->getBufferMs();
+			json notification = JsonNotification::getJson("Stream.OnUpdate", stream->toJson());
+			controlServer_->send(notification.dump(), controlSession);
+		}
 		else if (request.method == "Server.DeleteClient")
 		{
 			clientInfo = Config::instance().getClientInfo(request.getParam("client").get<string>(), false);
 			if (clientInfo == nullptr)
 				throw JsonInternalErrorException("Client not found", request.id);
 			response = clientInfo->host.mac;
+			{
+				std::lock_guard<std::mutex> lock(statsMutex_);
+				clientStats_.erase(clientInfo->host.mac);
+			}
 			Config::instance().remove(clientInfo);
 			Config::instance().save();
 			json notification = JsonNotification::getJson("Client.OnDelete", clientInfo->toJson());
@@ -188,11 +288,14 @@ void StreamServer::onMessageReceived(ControlSession* controlSession, const std::
 			{
 				session->sendAsync(stream->getHeader());
 				session->setPcmStream(stream);
+				session->setBufferMs(getBufferMs(stream));
 			}
 		}
 		else if (request.method == "Client.SetLatency")
 		{
-			clientInfo->config.latency = request.getParam<int>("latency", -10000, settings_.bufferMs);
+			PcmStreamPtr stream = streamManager_->getStream(clientInfo->config.streamId);
+			int32_t bufferMs = stream ? stream->getBufferMs() : settings_.bufferMs;
+			clientInfo->config.latency = request.getParam<int>("latency", -10000, bufferMs);
 			response = clientInfo->config.latency;
 		}
 		else if (request.method == "Client.SetName")
@@ -205,13 +308,13 @@ void StreamServer::onMessageReceived(ControlSession* controlSession, const std::
 
 		if (clientInfo != nullptr)
 		{
-			serverSettings.setVolume(clientInfo->config.volume.percent);
-			serverSettings.setMuted(clientInfo->config.volume.muted);
-			serverSettings.setLatency(clientInfo->config.latency);
-
 			session_ptr session = getStreamSession(request.getParam("client").get<string>());
 			if (session != nullptr)
+			{
+				setClientSettings(serverSettings, clientInfo, session->pcmStream());
+				setTransport(serverSettings, session.get());
 				session->send(&serverSettings);
+			}
 
 			Config::instance().save();
 			json notification = JsonNotification::getJson("Client.OnUpdate", clientInfo->toJson());
@@ -235,14 +338,14 @@ void StreamServer::onMessageReceived(ControlSession* controlSession, const std::
 
 void StreamServer::onMessageReceived(StreamSession* connection, const msg::BaseMessage& baseMessage, char* buffer)
 {
-//	logD << "onMessageReceived: " << baseMessage.type << ", size: " << baseMessage.size << ", id: " << baseMessage.id << ", refers: " << baseMessage.refersTo << ", sent: " << baseMessage.sent.sec << "," << baseMessage.sent.usec << ", recv: " << baseMessage.received.sec << "," << baseMessage.received.usec << "\n";
+//	logD << "onMessageReceived: " << baseMessage.type << ", size: " << baseMessage.size << ", id: " << baseMessage.id << ", refers: " << baseMessage.refersTo << ", sent: " << baseMessage.sent.nsec << ", recv: " << baseMessage.received.nsec << "\n";
 	if (baseMessage.type == message_type::kTime)
 	{
 		msg::Time* timeMsg = new msg::Time();
 		timeMsg->deserialize(baseMessage, buffer);
 		timeMsg->refersTo = timeMsg->id;
 		timeMsg->latency = timeMsg->received - timeMsg->sent;
-//		logO << "Latency sec: " << timeMsg.latency.sec << ", usec: " << timeMsg.latency.usec << ", refers to: " << timeMsg.refersTo << "\n";
+//		logO << "Latency ns: " << timeMsg.latency.nsec << ", refers to: " << timeMsg.refersTo << "\n";
 		connection->sendAsync(timeMsg, true);
 
 		// refresh connection state
@@ -264,24 +367,13 @@ void StreamServer::onMessageReceived(StreamSession* connection, const msg::BaseM
 
 		logD << "request kServerSettings: " << connection->macAddress << "\n";
 //		std::lock_guard<std::mutex> mlock(mutex_);
-		ClientInfoPtr clientInfo = Config::instance().getClientInfo(connection->macAddress, true);
-		if (clientInfo == nullptr)
+		ClientInfoPtr client = Config::instance().getClientInfo(connection->macAddress, true);
+		if (client == nullptr)
 		{
 			logE << "could not get client info for MAC: " << connection->macAddress << "\n";
-		}
-		else
-		{
-			logD << "request kServerSettings\n";
-			msg::ServerSettings* serverSettings = new msg::ServerSettings();
-			serverSettings->setVolume(clientInfo->config.volume.percent);
-			serverSettings->setMuted(clientInfo->config.volume.muted);
-			serverSettings->setLatency(clientInfo->config.latency);
-			serverSettings->setBufferMs(settings_.bufferMs);
-			serverSettings->refersTo = helloMsg.id;
-			connection->sendAsync(serverSettings);
+			return;
 		}
 
-		ClientInfoPtr client = Config::instance().getClientInfo(connection->macAddress);
 		client->host.ip = connection->getIP();
 		client->host.name = helloMsg.getHostName();
 		client->host.os = helloMsg.getOS();
@@ -302,6 +394,25 @@ void StreamServer::onMessageReceived(StreamSession* connection, const msg::BaseM
 		Config::instance().save();
 
 		connection->setPcmStream(stream);
+		connection->setBufferMs(getBufferMs(stream));
+		/// version 1 and 2 clients use the same message format
+		connection->setProtocolVersion(std::max(2, std::min<int>(helloMsg.getProtocolVersion(), msg::protocolVersion)));
+		connection->setMulticast(!multicastSenders_.empty() && helloMsg.supportsMulticast());
+		if (!connection->isMulticast() && settings_.udp && (helloMsg.getUdpPort() != 0))
+		{
+			udp::endpoint endpoint(asio::ip::address::from_string(connection->getIP()), helloMsg.getUdpPort());
+			std::unique_ptr<DatagramSender> sender(new DatagramSender(io_service_, endpoint, settings_.fecGroup));
+			logO << "Sending chunks to " << connection->macAddress << " via UDP: " << sender->getEndpoint() << "\n";
+			connection->setDatagramSender(std::move(sender));
+		}
+
+		logD << "request kServerSettings\n";
+		msg::ServerSettings* serverSettings = new msg::ServerSettings();
+		setClientSettings(*serverSettings, client, stream);
+		setTransport(*serverSettings, connection);
+		serverSettings->refersTo = helloMsg.id;
+		connection->sendAsync(serverSettings);
+
 		auto headerChunk = stream->getHeader();
 		connection->sendAsync(headerChunk);
 
@@ -309,6 +420,252 @@ void StreamServer::onMessageReceived(StreamSession* connection, const msg::BaseM
 //		logO << notification.dump(4) << "\n";
 		controlServer_->send(notification.dump());
 	}
+	else if (baseMessage.type == message_type::kJitterReport)
+	{
+		msg::JitterReport report;
+		report.deserialize(baseMessage, buffer);
+		logD << "JitterReport from " << connection->macAddress << ", arrival age median: " << report.getMedianAgeMs() << ", p99: " << report.getP99AgeMs()
+			<< ", max: " << report.getMaxAgeMs() << ", late: " << report.getLateChunks() << ", required buffer: " << report.getRequiredBufferMs() << "\n";
+		connection->setRequiredBufferMs(report.getRequiredBufferMs());
+		connection->setChunksReceived();
+		updateBuffer(connection->pcmStream());
+	}
+	else if (baseMessage.type == message_type::kClientStats)
+	{
+		ClientStatsReport report;
+		report.received = time(NULL);
+		report.stats.deserialize(baseMessage, buffer);
+		logD << "ClientStats from " << connection->macAddress << ", buffer: " << report.stats.bufferMs << ", sync error: " << report.stats.syncErrorUs << "us, xruns: " << report.stats.xruns
+			<< ", resyncs: " << report.stats.resyncs << ", decode: " << report.stats.decodeUs << "us, rtt: " << report.stats.rttUs << "us\n";
+		std::lock_guard<std::mutex> lock(statsMutex_);
+		std::deque<ClientStatsReport>& reports = clientStats_[connection->macAddress];
+		reports.push_back(report);
+		if (reports.size() > clientStatsReports)
+			reports.pop_front();
+	}
+	else if (baseMessage.type == message_type::kChunkRequest)
+	{
+		msg::ChunkRequest request;
+		request.deserialize(baseMessage, buffer);
+		repair(connection, request.getChunks());
+	}
+}
+
+
+static json toJson(time_t received, const msg::ClientStats& stats)
+{
+	json j = {
+		{"time", received},
+		{"bufferMs", stats.bufferMs},
+		{"medianAgeMs", stats.medianAgeMs},
+		{"syncErrorUs", stats.syncErrorUs},
+		{"xruns", stats.xruns},
+		{"resyncs", stats.resyncs},
+		{"decodeUs", stats.decodeUs},
+		{"maxDecodeUs", stats.maxDecodeUs},
+		{"rttUs", stats.rttUs}
+	};
+	return j;
+}
+
+
+json StreamServer::getClientStats(const std::string& mac) const
+{
+	json reports = json::array();
+	std::lock_guard<std::mutex> lock(statsMutex_);
+	auto iter = clientStats_.find(mac);
+	if (iter != clientStats_.end())
+	{
+		for (const auto& report: iter->second)
+			reports.push_back(toJson(report.received, report.stats));
+	}
+	return reports;
+}
+
+
+json StreamServer::getStatsSummary() const
+{
+	json clients = json::array();
+	std::lock_guard<std::mutex> lock(statsMutex_);
+	for (const auto& client: clientStats_)
+	{
+		if (client.second.empty())
+			continue;
+		uint32_t xruns = 0;
+		uint32_t resyncs = 0;
+		uint32_t maxDecodeUs = 0;
+		int32_t maxSyncErrorUs = 0;
+		for (const auto& report: client.second)
+		{
+			xruns += report.stats.xruns;
+			resyncs += report.stats.resyncs;
+			maxDecodeUs = std::max(maxDecodeUs, report.stats.maxDecodeUs);
+			maxSyncErrorUs = std::max(maxSyncErrorUs, std::abs(report.stats.syncErrorUs));
+		}
+		const ClientStatsReport& latest = client.second.back();
+		clients.push_back({
+			{"client", client.first},
+			{"reports", client.second.size()},
+			{"since", client.second.front().received},
+			{"xruns", xruns},
+			{"resyncs", resyncs},
+			{"maxDecodeUs", maxDecodeUs},
+			{"maxSyncErrorUs", maxSyncErrorUs},
+			{"latest", toJson(latest.received, latest.stats)}
+		});
+	}
+	return clients;
+}
+
+
+void StreamServer::setTransport(msg::ServerSettings& serverSettings, StreamSession* session) const
+{
+	serverSettings.setProtocolVersion(session->getProtocolVersion());
+	if (timeSyncServer_)
+		serverSettings.setTimeSyncPort(timeSyncServer_->getPort());
+	if (session->getDatagramSender())
+	{
+		serverSettings.setUdp(true);
+		return;
+	}
+	if (!session->isMulticast())
+		return;
+	PcmStreamPtr stream = session->pcmStream() ? session->pcmStream() : streamManager_->getDefaultStream();
+	auto multicastSender = multicastSenders_.find(stream.get());
+	if (multicastSender != multicastSenders_.end())
+		serverSettings.setMulticast(multicastSender->second->getEndpoint());
+}
+
+
+void StreamServer::repair(StreamSession* session, const std::vector<uint32_t>& chunks)
+{
+	PcmStreamPtr stream = session->pcmStream() ? session->pcmStream() : streamManager_->getDefaultStream();
+	std::shared_ptr<DatagramSender> datagramSender = session->getDatagramSender();
+	DatagramSender* sender = datagramSender.get();
+	if (sender == nullptr)
+	{
+		auto multicastSender = multicastSenders_.find(stream.get());
+		if (multicastSender == multicastSenders_.end())
+			return;
+		sender = multicastSender->second.get();
+	}
+
+	/// a chunk is played bufferMs after its start, skip what can't arrive before that
+	int32_t bufferMs = getBufferMs(stream);
+	chronos::time_point_clk now = chronos::clk::now();
+	size_t resent(0), late(0);
+	for (auto chunkSeq: chunks)
+	{
+		std::shared_ptr<const msg::BaseMessage> chunk = sender->getChunk(chunkSeq);
+		if (!chunk)
+			continue;
+		const msg::WireChunk* wireChunk = dynamic_cast<const msg::WireChunk*>(chunk.get());
+		if ((wireChunk != NULL) && (std::chrono::duration_cast<chronos::msec>(now - wireChunk->start()).count() + minRepairLeadMs > bufferMs))
+		{
+			++late;
+			continue;
+		}
+		if (datagramSender)
+			datagramSender->resend(chunkSeq);
+		else
+			session->sendAsync(chunk);
+		++resent;
+	}
+	logD << "Repair for " << session->macAddress << ": " << chunks.size() << " requested, " << resent << " resent, " << late << " too late\n";
+}
+
+
+PcmStreamPtr StreamServer::getStream(const session_ptr& session) const
+{
+	PcmStreamPtr stream = session->pcmStream();
+	if (!stream)
+		stream = streamManager_->getDefaultStream();
+	return stream;
+}
+
+
+int32_t StreamServer::getBufferMs(const PcmStreamPtr& pcmStream) const
+{
+	PcmStreamPtr stream = pcmStream ? pcmStream : streamManager_->getDefaultStream();
+	if (!settings_.adaptiveBuffer || !stream->isBufferAdaptive())
+		return stream->getBufferMs();
+
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	auto iter = streamBuffers_.find(stream.get());
+	if (iter == streamBuffers_.end())
+		return stream->getBufferMs();
+	return std::min(iter->second.bufferMs, stream->getBufferMs());
+}
+
+
+void StreamServer::setClientSettings(msg::ServerSettings& serverSettings, const ClientInfoPtr& client, const PcmStreamPtr& stream) const
+{
+	int32_t bufferMs = getBufferMs(stream);
+	serverSettings.setVolume(client->config.volume.percent);
+	serverSettings.setMuted(client->config.volume.muted);
+	/// the latency was set for the client's previous stream, it might have a larger buffer
+	serverSettings.setLatency(std::min(client->config.latency, bufferMs));
+	serverSettings.setBufferMs(bufferMs);
+}
+
+
+void StreamServer::updateBuffer(const PcmStreamPtr& pcmStream)
+{
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	PcmStreamPtr stream = pcmStream ? pcmStream : streamManager_->getDefaultStream();
+
+	/// clients that did not report yet are not considered
+	int32_t required = 0;
+	for (auto session: sessions_)
+	{
+		if (getStream(session) == stream)
+			required = std::max(required, session->getRequiredBufferMs());
+	}
+	if (required == 0)
+		return;
+	/// a relayed stream reports it to its upstream
+	stream->setRequiredBufferMs(required);
+	if (!settings_.adaptiveBuffer || !stream->isBufferAdaptive())
+		return;
+	required = std::max(minAdaptiveBufferMs, std::min(stream->getBufferMs(), required));
+
+	long now = chronos::getTickCount();
+	auto iter = streamBuffers_.find(stream.get());
+	if (iter == streamBuffers_.end())
+		iter = streamBuffers_.insert(make_pair(stream.get(), StreamBuffer{stream->getBufferMs(), now})).first;
+	StreamBuffer& streamBuffer = iter->second;
+
+	/// raise immediately, lower by at least 10% and not earlier than 30s after the last change
+	if ((required < streamBuffer.bufferMs) && ((required > streamBuffer.bufferMs * 0.9) || (now - streamBuffer.lastChange < 30000)))
+		return;
+	if (required == streamBuffer.bufferMs)
+		return;
+
+	logO << "Buffer of stream " << stream->getName() << ": " << streamBuffer.bufferMs << "ms => " << required << "ms\n";
+	streamBuffer.bufferMs = required;
+	streamBuffer.lastChange = now;
+	sendBuffer(stream, true);
+}
+
+
+void StreamServer::sendBuffer(const PcmStreamPtr& stream, bool adaptive)
+{
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	int32_t bufferMs = getBufferMs(stream);
+	for (auto session: sessions_)
+	{
+		if (getStream(session) != stream)
+			continue;
+		session->setBufferMs(bufferMs);
+		ClientInfoPtr client = Config::instance().getClientInfo(session->macAddress);
+		if (client == nullptr)
+			continue;
+		msg::ServerSettings* serverSettings = new msg::ServerSettings();
+		setClientSettings(*serverSettings, client, stream);
+		serverSettings->setAdaptive(adaptive);
+		setTransport(*serverSettings, session.get());
+		session->sendAsync(serverSettings);
+	}
 }
 
 
@@ -376,7 +733,7 @@ void StreamServer::start()
 		controlServer_.reset(new ControlServer(io_service_, settings_.controlPort, this));
 		controlServer_->start();
 
-		streamManager_.reset(new StreamManager(this, settings_.sampleFormat, settings_.codec, settings_.streamReadMs));
+		streamManager_.reset(new StreamManager(this, settings_.sampleFormat, settings_.codec, settings_.streamReadMs, settings_.bufferMs));
 //	throw SnapException("xxx");
 		for (const auto& streamUri: settings_.pcmStreams)
 		{
@@ -386,6 +743,33 @@ void StreamServer::start()
 		}
 		streamManager_->start();
 
+		if (!settings_.multicast.empty())
+		{
+			size_t pos = settings_.multicast.rfind(':');
+			if (pos == string::npos)
+				throw SnapException("Multicast endpoint must be \"group:port\": " + settings_.multicast);
+			string group = settings_.multicast.substr(0, pos);
+			size_t port = cpt::stoul(settings_.multicast.substr(pos + 1));
+			for (const auto& stream: streamManager_->getStreams())
+			{
+				udp::endpoint endpoint(asio::ip::address::from_string(group), port + multicastSenders_.size());
+				std::unique_ptr<DatagramSender> sender(new DatagramSender(io_service_, endpoint, settings_.fecGroup));
+				logO << "Stream " << stream->getName() << ": multicast to " << sender->getEndpoint() << ", FEC group: " << settings_.fecGroup << "\n";
+				multicastSenders_[stream.get()] = std::move(sender);
+			}
+		}
+
+		try
+		{
+			timeSyncServer_.reset(new TimeSyncServer(io_service_, settings_.port));
+			timeSyncServer_->start();
+		}
+		catch (const std::exception& e)
+		{
+			logE << "Failed to start time sync on UDP port " << settings_.port << ": " << e.what() << "\n";
+			timeSyncServer_.reset();
+		}
+
 		acceptor_ = make_shared<tcp::acceptor>(*io_service_, tcp::endpoint(tcp::v4(), settings_.port));
 		startAccept();
 	}
@@ -405,6 +789,8 @@ void StreamServer::stop()
 		streamManager_->stop();
 		streamManager_ = nullptr;
 	}
+	multicastSenders_.clear();
+	timeSyncServer_.reset();
 
 	{
 		std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
@@ -24,6 +24,8 @@
 #include <thread>
 #include <memory>
 #include <set>
+#include <map>
+#include <deque>
 #include <sstream>
 #include <mutex>
 
@@ -34,7 +36,11 @@
 #include "message/message.h"
 #include "message/codecHeader.h"
 #include "message/serverSettings.h"
+#include "message/clientStats.h"
 #include "controlServer.h"
+#include "datagramSender.h"
+#include "timeSyncServer.h"
+#include "config.h"
 
 
 using asio::ip::tcp;
@@ -48,6 +54,9 @@ struct StreamServerSettings
 		controlPort(1705),
 		codec("flac"),
 		bufferMs(1000),
+		adaptiveBuffer(false),
+		udp(false),
+		fecGroup(4),
 		sampleFormat("48000:16:2"),
 		streamReadMs(20)
 	{
@@ -57,6 +66,14 @@ struct StreamServerSettings
 	std::vector<std::string> pcmStreams;
 	std::string codec;
 	int32_t bufferMs;
+	/// adapt the buffer per stream to the clients' JitterReports, the stream's buffer is the maximum
+	bool adaptiveBuffer;
+	/// "group:port" to publish the chunks to, the n-th stream uses port + n. Empty: TCP only
+	std::string multicast;
+	/// send the chunks to the clients' UDP ports, if supported (multicast takes precedence)
+	bool udp;
+	/// data datagrams per XOR parity datagram, < 2: no FEC
+	size_t fecGroup;
 	std::string sampleFormat;
 	size_t streamReadMs;
 };
@@ -92,14 +109,58 @@ public:
 	virtual void onStateChanged(const PcmStream* pcmStream, const ReaderState& state);
 	virtual void onChunkRead(const PcmStream* pcmStream, const msg::PcmChunk* chunk, double duration);
 	virtual void onResync(const PcmStream* pcmStream, double ms);
+	virtual void onHeaderChanged(const PcmStream* pcmStream, const std::shared_ptr<msg::CodecHeader>& header);
+	virtual void onBufferChanged(const PcmStream* pcmStream, bool adaptive);
 
 private:
 	void startAccept();
 	void handleAccept(socket_ptr socket);
 	session_ptr getStreamSession(const std::string& mac) const;
 	session_ptr getStreamSession(StreamSession* session) const;
+
+	/// Buffer of the stream (or the default stream, if null): the stream's buffer or the adapted buffer
+	int32_t getBufferMs(const PcmStreamPtr& stream) const;
+	/// Volume, mute, latency and buffer of the client, playing the stream
+	void setClientSettings(msg::ServerSettings& serverSettings, const ClientInfoPtr& client, const PcmStreamPtr& stream) const;
+	/// Sends the stream's buffer to its clients and sets it for their sessions
+	/// adaptive: the clients move to the new buffer gradually, otherwise they resync
+	void sendBuffer(const PcmStreamPtr& stream, bool adaptive = false);
+	/// Passes the largest buffer required by the stream's clients to the stream and adapts
+	/// the stream's buffer to it, raised immediately, lowered after 30s. Sends the new buffer to the clients
+	void updateBuffer(const PcmStreamPtr& stream);
+	PcmStreamPtr getStream(const session_ptr& session) const;
+	/// Sets the session's protocol version, the time sync port and its multicast endpoint or UDP flag, if it receives the chunks as datagrams
+	void setTransport(msg::ServerSettings& serverSettings, StreamSession* session) const;
+	/// The client doesn't receive the datagrams, chunks are sent on the session from now on
+	void disableDatagrams(const session_ptr& session);
+	/// Resends chunks that the session missed on its datagram channel and that can still be played in time
+	void repair(StreamSession* session, const std::vector<uint32_t>& chunks);
+	/// Stats reports of the client, oldest first
+	json getClientStats(const std::string& mac) const;
+	/// Latest report and totals over the kept reports of every client
+	json getStatsSummary() const;
+
+	struct StreamBuffer
+	{
+		int32_t bufferMs;
+		long lastChange;
+	};
 	mutable std::recursive_mutex sessionsMutex_;
 	std::set<session_ptr> sessions_;
+	/// adapted buffers, guarded by sessionsMutex_
+	std::map<const PcmStream*, StreamBuffer> streamBuffers_;
+	std::map<const PcmStream*, std::unique_ptr<DatagramSender>> multicastSenders_;
+
+	struct ClientStatsReport
+	{
+		time_t received;
+		msg::ClientStats stats;
+	};
+	/// the last ClientStats reports per client (MAC) until it is deleted, guarded by statsMutex_
+	mutable std::mutex statsMutex_;
+	std::map<std::string, std::deque<ClientStatsReport>> clientStats_;
+	/// UDP time sync on the server port, null if it couldn't be opened
+	std::unique_ptr<TimeSyncServer> timeSyncServer_;
 	asio::io_service* io_service_;
 	std::shared_ptr<tcp::acceptor> acceptor_;
 
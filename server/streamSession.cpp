@@ -19,16 +19,20 @@
 #include "streamSession.h"
 
 #include <iostream>
+#include <sstream>
 #include <mutex>
 #include "common/log.h"
+#include "common/socketZeroCopy.h"
 #include "message/pcmChunk.h"
 
 using namespace std;
 
+/// MSG_ZEROCOPY has a per-send overhead (page pinning, completion), it pays for larger payloads
+static const size_t zeroCopyMinSize = 10000;
 
 
 StreamSession::StreamSession(MessageReceiver* receiver, std::shared_ptr<tcp::socket> socket) :
-	active_(false), readerThread_(nullptr), writerThread_(nullptr), messageReceiver_(receiver), pcmStream_(nullptr)
+	active_(false), readerThread_(nullptr), writerThread_(nullptr), messageReceiver_(receiver), bufferMs_(0), requiredBufferMs_(0), multicast_(false), chunksReceived_(0), datagramsSince_(0), lastDatagram_(0), protocolVersion_(2), sendProtocolVersion_(2), zeroCopy_(false), zeroCopySends_(0), pcmStream_(nullptr)
 {
 	socket_ = socket;
 }
@@ -58,6 +62,7 @@ void StreamSession::start()
 		std::lock_guard<std::mutex> activeLock(activeMutex_);
 		active_ = true;
 	}
+	zeroCopy_ = enableZeroCopy(socket_->native_handle());
 	readerThread_.reset(new thread(&StreamSession::reader, this));
 	writerThread_.reset(new thread(&StreamSession::writer, this));
 }
@@ -153,7 +158,80 @@ void StreamSession::setBufferMs(size_t bufferMs)
 }
 
 
+void StreamSession::setRequiredBufferMs(int32_t bufferMs)
+{
+	requiredBufferMs_ = bufferMs;
+}
+
+
+int32_t StreamSession::getRequiredBufferMs() const
+{
+	return requiredBufferMs_;
+}
+
+
+void StreamSession::setMulticast(bool multicast)
+{
+	multicast_ = multicast;
+}
+
+
+bool StreamSession::isMulticast() const
+{
+	return multicast_;
+}
+
+
+void StreamSession::setDatagramSender(std::unique_ptr<DatagramSender> sender)
+{
+	std::lock_guard<std::mutex> lock(datagramMutex_);
+	datagramSender_ = std::move(sender);
+}
+
+
+std::shared_ptr<DatagramSender> StreamSession::getDatagramSender() const
+{
+	std::lock_guard<std::mutex> lock(datagramMutex_);
+	return datagramSender_;
+}
+
+
+void StreamSession::setChunksReceived()
+{
+	chunksReceived_ = chronos::getTickCount();
+}
+
+
+bool StreamSession::isDatagramLost(long timeoutMs)
+{
+	long now = chronos::getTickCount();
+	/// the stream was paused, start over
+	if (now - lastDatagram_ > 1000)
+		datagramsSince_ = now;
+	lastDatagram_ = now;
+	return (now - std::max(datagramsSince_.load(), chunksReceived_.load()) > timeoutMs);
+}
+
+
+void StreamSession::setProtocolVersion(uint16_t version)
+{
+	protocolVersion_ = version;
+}
+
+
+uint16_t StreamSession::getProtocolVersion() const
+{
+	return protocolVersion_;
+}
+
+
 bool StreamSession::send(const msg::BaseMessage* message) const
+{
+	return send(message, nullptr);
+}
+
+
+bool StreamSession::send(const msg::BaseMessage* message, const std::shared_ptr<const msg::BaseMessage>& owner) const
 {
 	//TODO on exception: set active = false
 //	logO << "send: " << message->type << ", size: " << message->getSize() << ", id: " << message->id << ", refers: " << message->refersTo << "\n";
@@ -163,12 +241,42 @@ bool StreamSession::send(const msg::BaseMessage* message) const
 		if (!socket_ || !active_)
 			return false;
 	}
-	asio::streambuf streambuf;
-	std::ostream stream(&streambuf);
+	/// Only the headers are serialized, the payloads are sent from where they are
+	std::ostringstream stream;
+	std::vector<msg::PayloadRef> payloads;
 	tv t;
 	message->sent = t;
-	message->serialize(stream);
-	asio::write(*socket_.get(), streambuf);
+	message->serialize(stream, payloads, sendProtocolVersion_);
+	std::shared_ptr<std::string> header = make_shared<std::string>(stream.str());
+
+	std::vector<iovec> iov;
+	size_t pos = 0;
+	size_t payloadSize = 0;
+	for (const auto& payload: payloads)
+	{
+		size_t offset = payload.offset;
+		if (offset > pos)
+			iov.push_back({&(*header)[pos], offset - pos});
+		pos = offset;
+		if (payload.size > 0)
+			iov.push_back({(void*)payload.data, payload.size});
+		payloadSize += payload.size;
+	}
+	if (pos < header->size())
+		iov.push_back({&(*header)[pos], header->size() - pos});
+
+	/// zero copy needs the owner to keep the payload until the kernel is done with it
+	bool zeroCopy = zeroCopy_ && owner && (payloadSize >= zeroCopyMinSize);
+	uint32_t zeroCopySends = sendAll(socket_->native_handle(), iov, zeroCopy);
+	if (zeroCopySends > 0)
+	{
+		zeroCopySends_ += zeroCopySends;
+		zeroCopyInFlight_.push_back({zeroCopySends_ - 1, owner, header});
+	}
+	reapZeroCopy();
+
+	if (message->type == message_type::kServerSettings)
+		sendProtocolVersion_ = protocolVersion_;
 //	logO << "done: " << message->type << ", size: " << message->size << ", id: " << message->id << ", refers: " << message->refersTo << "\n";
 	return true;
 }
@@ -180,7 +288,7 @@ void StreamSession::getNextMessage()
 	size_t baseMsgSize = baseMessage.getSize();
 	vector<char> buffer(baseMsgSize);
 	socketRead(&buffer[0], baseMsgSize);
-	baseMessage.deserialize(&buffer[0]);
+	baseMessage.deserialize(&buffer[0], protocolVersion_);
 	if (baseMessage.size > msg::max_size)
 	{
 		logS(kLogErr) << "received message of type " << baseMessage.type << " to large: " << baseMessage.size << "\n";
@@ -221,6 +329,74 @@ void StreamSession::reader()
 }
 
 
+void StreamSession::reapZeroCopy() const
+{
+	if (zeroCopyInFlight_.empty())
+		return;
+	uint32_t completed;
+	bool copied = false;
+	if (!readZeroCopyCompletions(socket_->native_handle(), completed, copied))
+		return;
+	while (!zeroCopyInFlight_.empty() && ((int32_t)(completed - zeroCopyInFlight_.front().send) >= 0))
+		zeroCopyInFlight_.pop_front();
+	if (copied && zeroCopy_)
+	{
+		logO << "Zero copy sends are copied by the kernel, disabling them\n";
+		zeroCopy_ = false;
+	}
+}
+
+
+bool StreamSession::isOutdated(const msg::WireChunk& wireChunk) const
+{
+	if (bufferMs_ == 0)
+		return false;
+	chronos::time_point_clk now = chronos::clk::now();
+	size_t age = 0;
+	if (now > wireChunk.start())
+		age = std::chrono::duration_cast<chronos::msec>(now - wireChunk.start()).count();
+	//logD << "PCM chunk. Age: " << age << ", buffer: " << bufferMs_ << ", age > buffer: " << (age > bufferMs_) << "\n";
+	return (age > bufferMs_);
+}
+
+
+uint16_t StreamSession::getSendProtocolVersion() const
+{
+	std::lock_guard<std::mutex> socketLock(socketMutex_);
+	return sendProtocolVersion_;
+}
+
+
+void StreamSession::sendChunks(const std::shared_ptr<const msg::WireChunk>& wireChunk)
+{
+	/// Chunks that queued up meanwhile are sent along in one WireChunkBatch
+	std::shared_ptr<msg::WireChunkBatch> batch = make_shared<msg::WireChunkBatch>();
+	batch->add(wireChunk);
+	shared_ptr<const msg::BaseMessage> message;
+	while (messages_.try_pop(message, std::chrono::microseconds(0)))
+	{
+		auto next = std::dynamic_pointer_cast<const msg::WireChunk>(message);
+		if (!next)
+		{
+			messages_.push_front(message);
+			break;
+		}
+		if (isOutdated(*next))
+			continue;
+		if (!batch->add(next))
+		{
+			messages_.push_front(message);
+			break;
+		}
+	}
+
+	if (batch->chunks.size() == 1)
+		send(wireChunk.get(), wireChunk);
+	else
+		send(batch.get(), batch);
+}
+
+
 void StreamSession::writer()
 {
 	try
@@ -232,21 +408,16 @@ void StreamSession::writer()
 		{
 			if (messages_.try_pop(message, std::chrono::milliseconds(500)))
 			{
-				if (bufferMs_ > 0)
-				{
-					const msg::WireChunk* wireChunk = dynamic_cast<const msg::WireChunk*>(message.get());
-					if (wireChunk != NULL)
-					{
-						chronos::time_point_clk now = chronos::clk::now();
-						size_t age = 0;
-						if (now > wireChunk->start())
-							age = std::chrono::duration_cast<chronos::msec>(now - wireChunk->start()).count();
-						//logD << "PCM chunk. Age: " << age << ", buffer: " << bufferMs_ << ", age > buffer: " << (age > bufferMs_) << "\n";
-						if (age > bufferMs_)
-							continue;
-					}
-				}
-				send(message.get());
+				const msg::WireChunk* wireChunk = dynamic_cast<const msg::WireChunk*>(message.get());
+				if ((wireChunk != NULL) && isOutdated(*wireChunk))
+					continue;
+				shared_ptr<DatagramSender> datagramSender = getDatagramSender();
+				if ((wireChunk != NULL) && datagramSender)
+					datagramSender->send(message);
+				else if ((wireChunk != NULL) && !multicast_ && (getSendProtocolVersion() >= 4))
+					sendChunks(std::static_pointer_cast<const msg::WireChunk>(message));
+				else
+					send(message.get(), message);
 			}
 		}
 	}
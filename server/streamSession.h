@@ -27,9 +27,12 @@
 #include <condition_variable>
 #include <set>
 #include <mutex>
+#include <deque>
 #include "message/message.h"
+#include "message/wireChunkBatch.h"
 #include "common/queue.h"
 #include "streamreader/streamManager.h"
+#include "datagramSender.h"
 
 
 using asio::ip::tcp;
@@ -74,6 +77,29 @@ public:
 	/// Max playout latency. No need to send PCM data that is older than bufferMs
 	void setBufferMs(size_t bufferMs);
 
+	/// Buffer the client needs according to its last JitterReport, 0 if unknown
+	void setRequiredBufferMs(int32_t bufferMs);
+	int32_t getRequiredBufferMs() const;
+
+	/// Chunks are received via multicast, only repairs are sent on this connection
+	void setMulticast(bool multicast);
+	bool isMulticast() const;
+
+	/// Chunks are sent as datagrams to the client's UDP port, control messages on this connection
+	void setDatagramSender(std::unique_ptr<DatagramSender> sender);
+	std::shared_ptr<DatagramSender> getDatagramSender() const;
+
+	/// The client receives chunks (i.e. sent a JitterReport)
+	void setChunksReceived();
+	/// Called for every chunk sent to the client as datagram. True if the client did not report
+	/// receiving chunks (setChunksReceived) for "timeoutMs" of continuous sending
+	bool isDatagramLost(long timeoutMs);
+
+	/// Protocol version negotiated in the Hello. Received messages use it right away,
+	/// sent messages after the next ServerSettings, which announces it
+	void setProtocolVersion(uint16_t version);
+	uint16_t getProtocolVersion() const;
+
 	std::string macAddress;
 
 	std::string getIP()
@@ -89,6 +115,16 @@ protected:
 	void getNextMessage();
 	void reader();
 	void writer();
+	/// Sends the message with one vectored write, payloads are not copied.
+	/// If "owner" is set, large payloads are sent with MSG_ZEROCOPY and owner is kept until the send completed
+	bool send(const msg::BaseMessage* message, const std::shared_ptr<const msg::BaseMessage>& owner) const;
+	/// Releases the owners of completed zero copy sends, socketMutex_ must be locked
+	void reapZeroCopy() const;
+	/// Chunk is older than the buffer, i.e. would be played late
+	bool isOutdated(const msg::WireChunk& wireChunk) const;
+	uint16_t getSendProtocolVersion() const;
+	/// Sends the chunk together with the directly following queued ones
+	void sendChunks(const std::shared_ptr<const msg::WireChunk>& wireChunk);
 
 	mutable std::mutex activeMutex_;
 	std::atomic<bool> active_;
@@ -99,7 +135,28 @@ protected:
 	std::shared_ptr<tcp::socket> socket_;
 	MessageReceiver* messageReceiver_;
 	Queue<std::shared_ptr<const msg::BaseMessage>> messages_;
-	size_t bufferMs_;
+	std::atomic<size_t> bufferMs_;
+	std::atomic<int32_t> requiredBufferMs_;
+	std::atomic<bool> multicast_;
+	mutable std::mutex datagramMutex_;
+	std::shared_ptr<DatagramSender> datagramSender_;
+	std::atomic<long> chunksReceived_;
+	std::atomic<long> datagramsSince_;
+	std::atomic<long> lastDatagram_;
+	std::atomic<uint16_t> protocolVersion_;
+	/// guarded by socketMutex_
+	mutable uint16_t sendProtocolVersion_;
+
+	struct ZeroCopySend
+	{
+		uint32_t send;
+		std::shared_ptr<const msg::BaseMessage> owner;
+		std::shared_ptr<std::string> header;
+	};
+	/// guarded by socketMutex_
+	mutable bool zeroCopy_;
+	mutable uint32_t zeroCopySends_;
+	mutable std::deque<ZeroCopySend> zeroCopyInFlight_;
 	PcmStreamPtr pcmStream_;
 };
 
@@ -50,7 +50,7 @@ FileStream::~FileStream()
 
 void FileStream::worker()
 {
-	timeval tvChunk;
+	tv tvChunk;
 	std::unique_ptr<msg::PcmChunk> chunk(new msg::PcmChunk(sampleFormat_, pcmReadMs_));
 
 	ifs.seekg (0, ifs.end);
@@ -61,15 +61,14 @@ void FileStream::worker()
 
 	while (active_)
 	{
-		gettimeofday(&tvChunk, NULL);
+		tvChunk = tv();
 		tvEncodedChunk_ = tvChunk;
 		long nextTick = chronos::getTickCount();
 		try
 		{
 			while (active_)
 			{
-				chunk->timestamp.sec = tvChunk.tv_sec;
-				chunk->timestamp.usec = tvChunk.tv_usec;
+				chunk->timestamp = tvChunk;
 				size_t toRead = chunk->payloadSize;
 				size_t count = 0;
 
@@ -86,7 +85,7 @@ void FileStream::worker()
 				encoder_->encode(chunk.get());
 				if (!active_) break;
 				nextTick += pcmReadMs_;
-				chronos::addUs(tvChunk, pcmReadMs_ * 1000);
+				tvChunk = tvChunk + tv(0, pcmReadMs_ * 1000);
 				long currentTick = chronos::getTickCount();
 
 				if (nextTick >= currentTick)
@@ -97,7 +96,7 @@ void FileStream::worker()
 				}
 				else
 				{
-					gettimeofday(&tvChunk, NULL);
+					tvChunk = tv();
 					tvEncodedChunk_ = tvChunk;
 					pcmListener_->onResync(this, currentTick - nextTick);
 					nextTick = currentTick;
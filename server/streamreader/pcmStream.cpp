@@ -16,6 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <algorithm>
 #include <memory>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -32,7 +33,7 @@ using namespace std;
 
 
 PcmStream::PcmStream(PcmListener* pcmListener, const StreamUri& uri) : 
-	active_(false), pcmListener_(pcmListener), uri_(uri), pcmReadMs_(20), state_(kIdle)
+	active_(false), encodedNsRemainder_(0.), pcmListener_(pcmListener), uri_(uri), pcmReadMs_(20), bufferMs_(1000), state_(kIdle)
 {
 	EncoderFactory encoderFactory;
  	if (uri_.query.find("codec") == uri_.query.end())
@@ -50,6 +51,14 @@ PcmStream::PcmStream(PcmListener* pcmListener, const StreamUri& uri) :
 
  	if (uri_.query.find("buffer_ms") != uri_.query.end())
 		pcmReadMs_ = cpt::stoul(uri_.query["buffer_ms"]);
+
+ 	if (uri_.query.find("buffer") != uri_.query.end())
+		bufferMs_ = cpt::stoi(uri_.query["buffer"]);
+	if ((bufferMs_ < minStreamBufferMs) || (bufferMs_ > maxStreamBufferMs))
+	{
+		bufferMs_ = std::max(minStreamBufferMs, std::min(maxStreamBufferMs, bufferMs_.load()));
+		logE << "Buffer of stream " << name_ << " out of range, using " << bufferMs_ << "ms\n";
+	}
 }
 
 
@@ -89,6 +98,29 @@ const SampleFormat& PcmStream::getSampleFormat() const
 }
 
 
+int32_t PcmStream::getBufferMs() const
+{
+	return bufferMs_;
+}
+
+
+void PcmStream::setBufferMs(int32_t bufferMs)
+{
+	bufferMs_ = bufferMs;
+}
+
+
+bool PcmStream::isBufferAdaptive() const
+{
+	return true;
+}
+
+
+void PcmStream::setRequiredBufferMs(int32_t bufferMs)
+{
+}
+
+
 void PcmStream::start()
 {
 	logD << "PcmStream start: " << sampleFormat_.getFormat() << "\n";
@@ -140,11 +172,18 @@ void PcmStream::onChunkEncoded(const Encoder* encoder, msg::PcmChunk* chunk, dou
 {
 //	logO << "onChunkEncoded: " << duration << " us\n";
 	if (duration <= 0)
+	{
+		delete chunk;
 		return;
+	}
 
-	chunk->timestamp.sec = tvEncodedChunk_.tv_sec;
-	chunk->timestamp.usec = tvEncodedChunk_.tv_usec;
-	chronos::addUs(tvEncodedChunk_, duration * 1000);
+	chunk->timestamp = tvEncodedChunk_;
+	/// Chunk durations are fractional (e.g. Vorbis pages), carry the
+	/// sub-nanosecond rest to keep the timestamps from drifting
+	double ns = duration * 1000000. + encodedNsRemainder_;
+	int64_t wholeNs = (int64_t)ns;
+	encodedNsRemainder_ = ns - wholeNs;
+	tvEncodedChunk_.nsec += wholeNs;
 	if (pcmListener_)
 		pcmListener_->onChunkRead(this, chunk, duration);
 }
@@ -163,8 +202,11 @@ json PcmStream::toJson() const
 	json j = {
 		{"uri", uri_.toJson()},
 		{"id", getId()},
-		{"status", state}
+		{"status", state},
+		{"buffer", getBufferMs()}
 	};
+	/// the buffer might have been changed (Stream.SetBuffer) since the stream was added
+	j["uri"]["query"]["buffer"] = cpt::to_string(getBufferMs());
 	return j;
 }
 
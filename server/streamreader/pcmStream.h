@@ -34,6 +34,10 @@
 
 class PcmStream;
 
+/// Range of the buffer that can be configured per stream [ms]
+const int32_t minStreamBufferMs = 20;
+const int32_t maxStreamBufferMs = 10000;
+
 enum ReaderState
 {
 	kUnknown = 0,
@@ -53,6 +57,11 @@ public:
 	virtual void onStateChanged(const PcmStream* pcmStream, const ReaderState& state) = 0;
 	virtual void onChunkRead(const PcmStream* pcmStream, const msg::PcmChunk* chunk, double duration) = 0;
 	virtual void onResync(const PcmStream* pcmStream, double ms) = 0;
+	/// The codec header changed while the stream is running (i.e. of a relayed stream)
+	virtual void onHeaderChanged(const PcmStream* pcmStream, const std::shared_ptr<msg::CodecHeader>& header) = 0;
+	/// The stream's buffer was changed by its source (i.e. the upstream of a relayed stream)
+	/// adaptive: the source's clients move to it gradually (see msg::ServerSettings::isAdaptive)
+	virtual void onBufferChanged(const PcmStream* pcmStream, bool adaptive) = 0;
 };
 
 
@@ -80,6 +89,13 @@ public:
 	virtual const std::string& getName() const;
 	virtual const std::string& getId() const;
 	virtual const SampleFormat& getSampleFormat() const;
+	/// Playout buffer of the stream's clients [ms] ("buffer" in the URI)
+	virtual int32_t getBufferMs() const;
+	virtual void setBufferMs(int32_t bufferMs);
+	/// false: the buffer is given by the source (i.e. relayed), it's not adapted to the clients
+	virtual bool isBufferAdaptive() const;
+	/// Largest buffer required by the stream's clients (see msg::JitterReport) [ms]
+	virtual void setRequiredBufferMs(int32_t bufferMs);
 
 	virtual ReaderState getState() const;
 	virtual json toJson() const;
@@ -95,11 +111,13 @@ protected:
 	virtual bool sleep(int32_t ms);
 	void setState(const ReaderState& newState);
 
-	timeval tvEncodedChunk_;
+	tv tvEncodedChunk_;
+	double encodedNsRemainder_;
 	PcmListener* pcmListener_;
 	StreamUri uri_;
 	SampleFormat sampleFormat_;
 	size_t pcmReadMs_;
+	std::atomic<int32_t> bufferMs_;
 	std::unique_ptr<Encoder> encoder_;
 	std::string name_;
 	ReaderState state_;
@@ -60,7 +60,7 @@ PipeStream::~PipeStream()
 
 void PipeStream::worker()
 {
-	timeval tvChunk;
+	tv tvChunk;
 	std::unique_ptr<msg::PcmChunk> chunk(new msg::PcmChunk(sampleFormat_, pcmReadMs_));
 
 	while (active_)
@@ -68,7 +68,7 @@ void PipeStream::worker()
 		if (fd_ != -1)
 			close(fd_);
 		fd_ = open(uri_.path.c_str(), O_RDONLY | O_NONBLOCK);
-		gettimeofday(&tvChunk, NULL);
+		tvChunk = tv();
 		tvEncodedChunk_ = tvChunk;
 		long nextTick = chronos::getTickCount();
 		try
@@ -78,8 +78,7 @@ void PipeStream::worker()
 
 			while (active_)
 			{
-				chunk->timestamp.sec = tvChunk.tv_sec;
-				chunk->timestamp.usec = tvChunk.tv_usec;
+				chunk->timestamp = tvChunk;
 				int toRead = chunk->payloadSize;
 				int len = 0;
 				do
@@ -105,7 +104,7 @@ void PipeStream::worker()
 				if (!active_) break;
 
 				nextTick += pcmReadMs_;
-				chronos::addUs(tvChunk, pcmReadMs_ * 1000);
+				tvChunk = tvChunk + tv(0, pcmReadMs_ * 1000);
 				long currentTick = chronos::getTickCount();
 
 				if (nextTick >= currentTick)
@@ -116,7 +115,7 @@ void PipeStream::worker()
 				}
 				else
 				{
-					gettimeofday(&tvChunk, NULL);
+					tvChunk = tv();
 					tvEncodedChunk_ = tvChunk;
 					pcmListener_->onResync(this, currentTick - nextTick);
 					nextTick = currentTick;
@@ -144,7 +144,7 @@ void ProcessStream::stderrReader()
 
 void ProcessStream::worker()
 {
-	timeval tvChunk;
+	tv tvChunk;
 	std::unique_ptr<msg::PcmChunk> chunk(new msg::PcmChunk(sampleFormat_, pcmReadMs_));
 
 	setState(kPlaying);
@@ -158,15 +158,14 @@ void ProcessStream::worker()
 		stderrReaderThread_ = thread(&ProcessStream::stderrReader, this);
 		stderrReaderThread_.detach();
 
-		gettimeofday(&tvChunk, NULL);
+		tvChunk = tv();
 		tvEncodedChunk_ = tvChunk;
 		long nextTick = chronos::getTickCount();
 		try
 		{
 			while (active_)
 			{
-				chunk->timestamp.sec = tvChunk.tv_sec;
-				chunk->timestamp.usec = tvChunk.tv_usec;
+				chunk->timestamp = tvChunk;
 				int toRead = chunk->payloadSize;
 				int len = 0;
 				do
@@ -192,7 +191,7 @@ void ProcessStream::worker()
 				if (!active_) break;
 
 				nextTick += pcmReadMs_;
-				chronos::addUs(tvChunk, pcmReadMs_ * 1000);
+				tvChunk = tvChunk + tv(0, pcmReadMs_ * 1000);
 				long currentTick = chronos::getTickCount();
 
 				if (nextTick >= currentTick)
@@ -203,7 +202,7 @@ void ProcessStream::worker()
 				}
 				else
 				{
-					gettimeofday(&tvChunk, NULL);
+					tvChunk = tv();
 					tvEncodedChunk_ = tvChunk;
 					pcmListener_->onResync(this, currentTick - nextTick);
 					nextTick = currentTick;
@@ -0,0 +1,238 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <algorithm>
+#include <cstring>
+#include "relayStream.h"
+#include "message/hello.h"
+#include "message/time.h"
+#include "message/serverSettings.h"
+#include "message/jitterReport.h"
+#include "message/wireChunkBatch.h"
+#include "common/snapException.h"
+#include "common/strCompat.h"
+#include "common/log.h"
+
+
+using namespace std;
+
+static const size_t timeSyncRequests = 20;
+static const size_t timeSyncMinReplies = 8;
+
+
+
+RelayStream::RelayStream(PcmListener* pcmListener, const StreamUri& uri) : PcmStream(pcmListener, uri), connection_(nullptr), header_(nullptr), serverSettingsReceived_(false), connectionFailed_(false), lastTimestamp_(0), requiredBufferMs_(0)
+{
+	string host = uri_.host;
+	size_t port = 1704;
+	size_t pos = host.find(':');
+	if (pos != string::npos)
+	{
+		port = cpt::stoul(host.substr(pos + 1));
+		host = host.substr(0, pos);
+	}
+	if (host.empty())
+		throw SnapException("missing host of the upstream server");
+	logO << "RelayStream upstream: " << host << ":" << port << "\n";
+	connection_.reset(new ClientConnection(this, host, port));
+}
+
+
+RelayStream::~RelayStream()
+{
+	stop();
+}
+
+
+void RelayStream::start()
+{
+	/// chunks are passed on encoded, no need to init the encoder
+	active_ = true;
+	thread_ = thread(&RelayStream::worker, this);
+}
+
+
+std::shared_ptr<msg::CodecHeader> RelayStream::getHeader()
+{
+	/// null until it arrived, the encoder is not used
+	std::lock_guard<std::mutex> lock(headerMutex_);
+	return header_;
+}
+
+
+bool RelayStream::isBufferAdaptive() const
+{
+	return false;
+}
+
+
+void RelayStream::setRequiredBufferMs(int32_t bufferMs)
+{
+	requiredBufferMs_ = bufferMs;
+}
+
+
+void RelayStream::onException(ClientConnection* connection, const std::exception& exception)
+{
+	logE << "RelayStream::onException: " << exception.what() << "\n";
+	connectionFailed_ = true;
+	cv_.notify_one();
+}
+
+
+void RelayStream::onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer)
+{
+	if (baseMessage.type == message_type::kTime)
+	{
+		msg::Time reply;
+		reply.deserialize(baseMessage, buffer);
+		timeProvider_.setDiff(reply.latency, reply.received - reply.sent);
+	}
+	else if (baseMessage.type == message_type::kServerSettings)
+	{
+		msg::ServerSettings serverSettings;
+		serverSettings.deserialize(baseMessage, buffer);
+		logO << "RelayStream upstream buffer: " << serverSettings.getBufferMs() << ", latency: " << serverSettings.getLatency() << "\n";
+		/// the upstream's clients play with this buffer, the upstream changes it at runtime
+		int32_t bufferMs = serverSettings.getBufferMs() - serverSettings.getLatency();
+		bufferMs = std::max(minStreamBufferMs, std::min(maxStreamBufferMs, bufferMs));
+		if (bufferMs != getBufferMs())
+		{
+			setBufferMs(bufferMs);
+			if (pcmListener_)
+				pcmListener_->onBufferChanged(this, serverSettings.isAdaptive());
+		}
+		serverSettingsReceived_ = true;
+	}
+	else if (baseMessage.type == message_type::kCodecHeader)
+	{
+		std::shared_ptr<msg::CodecHeader> header(new msg::CodecHeader());
+		header->deserialize(baseMessage, buffer);
+		logO << "RelayStream codec: " << header->codec << "\n";
+		{
+			/// the upstream sends it again on every reconnect
+			std::lock_guard<std::mutex> lock(headerMutex_);
+			if (header_ && (header_->codec == header->codec) && (header_->payloadSize == header->payloadSize) &&
+				(memcmp(header_->payload, header->payload, header->payloadSize) == 0))
+				return;
+			header_ = header;
+		}
+		if (pcmListener_)
+			pcmListener_->onHeaderChanged(this, header);
+	}
+	else if (baseMessage.type == message_type::kWireChunk)
+	{
+		msg::PcmChunk* chunk = new msg::PcmChunk(sampleFormat_, 0);
+		chunk->deserialize(baseMessage, buffer);
+		passOn(chunk);
+	}
+	else if (baseMessage.type == message_type::kWireChunkBatch)
+	{
+		msg::WireChunkBatch batch;
+		batch.deserialize(baseMessage, buffer);
+		for (const auto& wireChunk: batch.chunks)
+			passOn(new msg::PcmChunk(sampleFormat_, *wireChunk));
+	}
+}
+
+
+void RelayStream::passOn(msg::PcmChunk* chunk)
+{
+	/// The payload stays encoded, only the timestamp is moved to the local clock
+	int64_t upstream = chunk->timestamp.nsec;
+	chunk->timestamp = tv(upstream - timeProvider_.getDiffToServer<chronos::nsec>().count());
+	int64_t last = lastTimestamp_.exchange(upstream);
+	double duration = (last == 0) ? 0. : (upstream - last) / 1000000.;
+	setState(kPlaying);
+	if (pcmListener_)
+		pcmListener_->onChunkRead(this, chunk, duration);
+	else
+		delete chunk;
+}
+
+
+size_t RelayStream::timeSyncBurst()
+{
+	size_t samples = timeProvider_.getSampleCount();
+	for (size_t n=0; n<timeSyncRequests && active_; ++n)
+	{
+		msg::Time timeReq;
+		connection_->send(&timeReq);
+		chronos::usleep(2000);
+	}
+	long burstStart = chronos::getTickCount();
+	while (active_ && (timeProvider_.getSampleCount() - samples < timeSyncMinReplies) && (chronos::getTickCount() - burstStart < 2000))
+		chronos::sleep(5);
+	return timeProvider_.getSampleCount() - samples;
+}
+
+
+void RelayStream::worker()
+{
+	while (active_)
+	{
+		try
+		{
+			serverSettingsReceived_ = false;
+			connectionFailed_ = false;
+			lastTimestamp_ = 0;
+			connection_->start();
+
+			/// chunks are received on the connection, no multicast or UDP
+			msg::Hello hello(connection_->getMacAddress());
+			hello.msg["ClientName"] = "Snapserver";
+			hello.setMulticast(false);
+			connection_->send(&hello);
+
+			/// time sync messages carry timestamps, wait for the protocol version
+			long helloSent = chronos::getTickCount();
+			while (active_ && !serverSettingsReceived_ && (chronos::getTickCount() - helloSent < 2000))
+				chronos::sleep(5);
+			if (!serverSettingsReceived_)
+				throw SnapException("no reply to hello");
+
+			if (timeSyncBurst() == 0)
+				throw SnapException("no reply to time sync requests");
+			logO << "RelayStream diff to upstream [ms]: " << (float)timeProvider_.getDiffToServer<chronos::usec>().count() / 1000.f << "\n";
+
+			while (active_ && !connectionFailed_)
+			{
+				if (!sleep(5000) || connectionFailed_)
+					break;
+				msg::Time timeReq;
+				connection_->send(&timeReq);
+				if (requiredBufferMs_ > 0)
+				{
+					msg::JitterReport report;
+					report.setRequiredBufferMs(requiredBufferMs_);
+					connection_->send(&report);
+				}
+			}
+			if (connectionFailed_)
+				throw SnapException("upstream connection lost");
+		}
+		catch (const std::exception& e)
+		{
+			logE << "Exception in RelayStream::worker(): " << e.what() << "\n";
+			connection_->stop();
+			setState(kIdle);
+			sleep(1000);
+		}
+	}
+	connection_->stop();
+}
@@ -0,0 +1,79 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef RELAY_STREAM_H
+#define RELAY_STREAM_H
+
+#include <atomic>
+#include <mutex>
+#include "pcmStream.h"
+#include "client/clientConnection.h"
+#include "client/timeProvider.h"
+
+
+/// Relays the stream of another snapserver
+/**
+ * Connects to the upstream server like a client does (using ClientConnection) and keeps
+ * its own TimeProvider synced to it.
+ * The received chunks are passed to the PcmListener still encoded. Their timestamps are
+ * translated from the upstream's clock to the local one and the stream's buffer follows
+ * the upstream's, so the relay's clients play in sync with the upstream's clients.
+ * The buffer is not adapted locally, instead the largest buffer required by the relay's
+ * clients is reported to the upstream (JitterReport), which adapts its buffer to it.
+ * The codec header is the upstream's, the "codec" and "sampleformat" of the URI are not used.
+ * It is passed to the PcmListener when it arrives or changes (onHeaderChanged).
+ * usage:
+ *   snapserver -s "snapcast://host[:port]/?name=Relay"
+ */
+class RelayStream : public PcmStream, public ClientMessageReceiver
+{
+public:
+	/// ctor. Chunks received from the upstream server are passed to the PcmListener
+	RelayStream(PcmListener* pcmListener, const StreamUri& uri);
+	virtual ~RelayStream();
+
+	virtual void start();
+	virtual std::shared_ptr<msg::CodecHeader> getHeader();
+	virtual bool isBufferAdaptive() const;
+	virtual void setRequiredBufferMs(int32_t bufferMs);
+
+	/// Implementation of ClientMessageReceiver
+	virtual void onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer);
+	virtual void onException(ClientConnection* connection, const std::exception& exception);
+
+protected:
+	virtual void worker();
+	/// Burst of time requests, returns the number of replies
+	size_t timeSyncBurst();
+	/// Passes an upstream chunk to the PcmListener (takes ownership)
+	void passOn(msg::PcmChunk* chunk);
+
+	std::unique_ptr<ClientConnection> connection_;
+	TimeProvider timeProvider_;
+	std::mutex headerMutex_;
+	std::shared_ptr<msg::CodecHeader> header_;
+	std::atomic<bool> serverSettingsReceived_;
+	std::atomic<bool> connectionFailed_;
+	/// upstream timestamp of the last chunk [ns]
+	std::atomic<int64_t> lastTimestamp_;
+	/// reported to the upstream, 0: unknown
+	std::atomic<int32_t> requiredBufferMs_;
+};
+
+
+#endif
@@ -22,6 +22,7 @@
 #include "processStream.h"
 #include "pipeStream.h"
 #include "fileStream.h"
+#include "relayStream.h"
 #include "common/utils.h"
 #include "common/strCompat.h"
 #include "common/log.h"
@@ -31,7 +32,7 @@
 using namespace std;
 
 
-StreamManager::StreamManager(PcmListener* pcmListener, const std::string& defaultSampleFormat, const std::string& defaultCodec, size_t defaultReadBufferMs) : pcmListener_(pcmListener), sampleFormat_(defaultSampleFormat), codec_(defaultCodec), readBufferMs_(defaultReadBufferMs)
+StreamManager::StreamManager(PcmListener* pcmListener, const std::string& defaultSampleFormat, const std::string& defaultCodec, size_t defaultReadBufferMs, int32_t defaultBufferMs) : pcmListener_(pcmListener), sampleFormat_(defaultSampleFormat), codec_(defaultCodec), readBufferMs_(defaultReadBufferMs), bufferMs_(defaultBufferMs)
 {
 }
 
@@ -49,6 +50,9 @@ PcmStreamPtr StreamManager::addStream(const std::string& uri)
 	if (streamUri.query.find("buffer_ms") == streamUri.query.end())
 		streamUri.query["buffer_ms"] = cpt::to_string(readBufferMs_);
 
+	if (streamUri.query.find("buffer") == streamUri.query.end())
+		streamUri.query["buffer"] = cpt::to_string(bufferMs_);
+
 //	logD << "\nURI: " << streamUri.uri << "\nscheme: " << streamUri.scheme << "\nhost: "
 //		<< streamUri.host << "\npath: " << streamUri.path << "\nfragment: " << streamUri.fragment << "\n";
 
@@ -76,6 +80,10 @@ PcmStreamPtr StreamManager::addStream(const std::string& uri)
 	{
 		stream = make_shared<AirplayStream>(pcmListener_, streamUri);
 	}
+	else if (streamUri.scheme == "snapcast")
+	{
+		stream = make_shared<RelayStream>(pcmListener_, streamUri);
+	}
 	else
 	{
 		throw SnapException("Unknown stream type: " + streamUri.scheme);
@@ -11,7 +11,7 @@ typedef std::shared_ptr<PcmStream> PcmStreamPtr;
 class StreamManager
 {
 public:
-	StreamManager(PcmListener* pcmListener, const std::string& defaultSampleFormat, const std::string& defaultCodec, size_t defaultReadBufferMs = 20);
+	StreamManager(PcmListener* pcmListener, const std::string& defaultSampleFormat, const std::string& defaultCodec, size_t defaultReadBufferMs = 20, int32_t defaultBufferMs = 1000);
 
 	PcmStreamPtr addStream(const std::string& uri);
 	void start();
@@ -27,6 +27,7 @@ private:
 	std::string sampleFormat_;
 	std::string codec_;
 	size_t readBufferMs_;
+	int32_t bufferMs_;
 };
 
 
@@ -0,0 +1,103 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sstream>
+#include "timeSyncServer.h"
+#include "message/time.h"
+#include "common/log.h"
+#include "common/socketTimestamp.h"
+
+using namespace std;
+
+
+TimeSyncServer::TimeSyncServer(asio::io_service* ioService, size_t port) : socket_(*ioService), port_(port), active_(false)
+{
+}
+
+
+TimeSyncServer::~TimeSyncServer()
+{
+	stop();
+}
+
+
+void TimeSyncServer::start()
+{
+	socket_.open(udp::v4());
+	socket_.bind(udp::endpoint(udp::v4(), port_));
+	if (!enableReceiveTimestamps(socket_.native_handle()))
+		logO << "Time sync: kernel receive timestamps not available\n";
+	logO << "Time sync on UDP port " << port_ << "\n";
+	active_ = true;
+	thread_ = thread(&TimeSyncServer::worker, this);
+}
+
+
+void TimeSyncServer::stop()
+{
+	if (!active_)
+		return;
+	active_ = false;
+	std::error_code ec;
+	/// wakes up the blocking receive
+	socket_.shutdown(udp::socket::shutdown_both, ec);
+	socket_.close(ec);
+	thread_.join();
+}
+
+
+void TimeSyncServer::worker()
+{
+	char buffer[256];
+	msg::BaseMessage baseMessage;
+	while (active_)
+	{
+		udp::endpoint from;
+		socklen_t fromLen = from.capacity();
+		tv received;
+		ssize_t size = receiveTimestamped(socket_.native_handle(), buffer, sizeof(buffer), received, from.data(), &fromLen);
+		if (!active_)
+			break;
+		if (size < 0)
+		{
+			logE << "Time sync receive error: " << strerror(errno) << "\n";
+			chronos::sleep(100);
+			continue;
+		}
+		from.resize(fromLen);
+
+		/// datagrams use the current protocol version
+		if ((size_t)size < baseMessage.getSize())
+			continue;
+		baseMessage.deserialize(buffer, msg::protocolVersion);
+		if ((baseMessage.type != message_type::kTime) || (baseMessage.getSize() + baseMessage.size > (size_t)size))
+			continue;
+
+		msg::Time reply;
+		reply.refersTo = baseMessage.id;
+		reply.received = received;
+		reply.latency = received - baseMessage.sent;
+		reply.sent = tv();
+		std::ostringstream stream;
+		reply.serialize(stream, msg::protocolVersion);
+		string data = stream.str();
+		std::error_code ec;
+		socket_.send_to(asio::buffer(data), from, 0, ec);
+	}
+}
+
@@ -0,0 +1,59 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2016  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef TIME_SYNC_SERVER_H
+#define TIME_SYNC_SERVER_H
+
+#include <asio.hpp>
+#include <atomic>
+#include <thread>
+
+
+using asio::ip::udp;
+
+
+/// Answers time sync requests (msg::Time) on a UDP port
+/**
+ * Runs on its own thread, independent of the audio connections and their send queues.
+ * Requests are stamped by the kernel on reception (SO_TIMESTAMPNS) and answered right away
+ */
+class TimeSyncServer
+{
+public:
+	TimeSyncServer(asio::io_service* ioService, size_t port);
+	~TimeSyncServer();
+
+	void start();
+	void stop();
+
+	size_t getPort() const
+	{
+		return port_;
+	}
+
+private:
+	void worker();
+
+	udp::socket socket_;
+	size_t port_;
+	std::atomic<bool> active_;
+	std::thread thread_;
+};
+
+
+#endif